@@ -7,13 +7,22 @@
 
 #include <string>
 #include <fstream>
+#include <ostream>
+#include <memory>
 #include <cstdio>
+#include <cstring>
+#include <algorithm>
 #include <type_traits>
+#include <unordered_map>
+#include <mutex>
+#include <vector>
+#include <pthread.h>
 
 #include "macros.h"
 #include "lock_free_q.h"
 #include "thread_utils.h"
 #include "time_utils.h"
+#include "log_sink.h"
 
 // SFINAE
 template<typename T>
@@ -92,7 +101,10 @@ template<typename T> using log_t = typename std::enable_if<is_matching<T>, T>::t
 
 namespace Common
 {
-	constexpr size_t LOG_Q_SIZE = 8 * 1024 * 1024;
+	// Default slots per producer lane, every thread that logs to a Logger gets its own lane.
+	constexpr size_t LOG_Q_SIZE = 256 * 1024;
+	constexpr size_t LOG_MAX_LANES = 64;
+	constexpr size_t LOG_LANE_CACHE_SIZE = 4;
 
 	enum class LogType : int8_t
 	{
@@ -104,170 +116,387 @@ namespace Common
 		UNSIGNED_LONG_INTEGER = 5,
 		UNSIGNED_LONG_LONG_INTEGER = 6,
 		FLOAT = 7,
-		DOUBLE = 8
+		DOUBLE = 8,
+		STRING = 9
 	};
 
-	struct LogElement
+	// TEXT has the logger thread format records into the file, BINARY dumps the raw records and a format string
+	// table so the formatting can be done offline by LogDecoder.
+	enum class LogMode : int8_t
 	{
-		LogType type_ = LogType::CHAR;
+		TEXT = 0,
+		BINARY = 1
+	};
 
-		//std::variant is not optimal since it tries to be "type safe" union is faster
-		union
-		{
-			char c;
-			int i;
-			long li;
-			long long ll;
-			unsigned u;
-			unsigned long ul;
-			unsigned long long ull;
-			float f;
-			double d;
-		} data_;
+	constexpr size_t LOG_RECORD_SIZE = 64;
+	constexpr size_t LOG_RECORD_PAYLOAD = LOG_RECORD_SIZE - sizeof(nanos) - sizeof(const char *) - 2;
 
-		LogElement() = default;
+	/* One queue slot per log() call instead of one per character. The hot thread stores the format string pointer
+	 * (which doubles as the format ID since log() is called with literals), a timestamp and the arguments encoded as
+	 * [LogType][raw bytes]. Strings are [STRING][uint32 length][chars]. Arguments that do not fit in one slot spill
+	 * into the following slots with more_ set, those continuation slots leave ts_ and fmt_ unused.
+	 */
+	struct LogRecord
+	{
+		nanos ts_ = 0;
+		const char *fmt_ = nullptr;
+		uint8_t len_ = 0;
+		bool more_ = false;
+		char payload_[LOG_RECORD_PAYLOAD];
+	};
 
-		LogElement(LogType type, char c) : type_(type)
-		{
-			data_.c = c;
-		}
+	static_assert(sizeof(LogRecord) == LOG_RECORD_SIZE, "LogRecord should fill exactly one cache line");
 
-		LogElement(LogType type, int i) : type_(type)
-		{
-			data_.i = i;
-		}
+	// Binary log file layout, all fields native endian:
+	//   header:  LOG_BINARY_MAGIC
+	//   format:  'F' uint32 id, uint32 length, chars
+	//   record:  'R' uint32 id, int64 timestamp, uint32 length, encoded arguments
+	constexpr char LOG_BINARY_MAGIC[8] = {'L', 'L', 'F', 'L', 'O', 'G', '1', '\n'};
+	constexpr char LOG_BINARY_FORMAT = 'F';
+	constexpr char LOG_BINARY_RECORD = 'R';
 
-		LogElement(LogType type, long l) : type_(type)
+	template<typename V>
+	inline bool read_log_arg(const char *&args, const char *end, V &value) noexcept
+	{
+		if (static_cast<size_t>(end - args) < sizeof(V))
 		{
-			data_.li = l;
+			return false;
 		}
 
-		LogElement(LogType type, long long ll) : type_(type)
+		memcpy(&value, args, sizeof(V));
+		args += sizeof(V);
+		return true;
+	}
+
+	/// One piece of a split format string: len_ literal characters starting at offset_, followed by an argument
+	/// when arg_ is set. "%%" ends a chunk after the first '%' so no escape handling is needed when emitting.
+	struct LogChunk
+	{
+		uint32_t offset_ = 0;
+		uint32_t len_ = 0;
+		bool arg_ = false;
+	};
+
+	/// Splits s into literal chunks and placeholders, calling emit for every chunk. Returns the placeholder count.
+	/// Usable at compile time by LogFormat and at runtime by the logger thread and LogDecoder.
+	template<typename F>
+	constexpr size_t split_log_format(const char *s, F &&emit)
+	{
+		size_t args = 0;
+		uint32_t begin = 0;
+		uint32_t i = 0;
+
+		for (; s[i]; i++)
 		{
-			data_.ll = ll;
+			if (s[i] == '%')
+			{
+				if (s[i + 1] == '%')
+				{
+					emit(LogChunk {begin, i + 1 - begin, false});
+					i++;
+				}
+				else
+				{
+					emit(LogChunk {begin, i - begin, true});
+					args++;
+				}
+				begin = i + 1;
+			}
 		}
 
-		LogElement(LogType type, unsigned u) : type_(type)
+		emit(LogChunk {begin, i - begin, false});
+		return args;
+	}
+
+	inline std::vector<LogChunk> split_log_format(const char *s)
+	{
+		std::vector<LogChunk> chunks;
+		split_log_format(s, [&chunks](const LogChunk &chunk)
 		{
-			data_.u = u;
-		}
+			chunks.push_back(chunk);
+		});
+		return chunks;
+	}
+
+	// Deliberately not constexpr: reaching it while evaluating LogFormat's constructor is a compile error that
+	// names the problem.
+	inline void log_format_argument_count_mismatch()
+	{
+	}
+
+	/* Format string checked at compile time. log() takes it through std::type_identity_t so the argument types are
+	 * deduced from the arguments alone and a string literal converts implicitly, which keeps the existing
+	 * log("...", args...) call syntax while turning the old runtime FATAL for a mismatched argument count into a
+	 * compile error.
+	 */
+	template<typename... A>
+	struct LogFormat
+	{
+		const char *str_;
 
-		LogElement(LogType type, unsigned long ul) : type_(type)
+		template<size_t N>
+		consteval LogFormat(const char (&s)[N]) : str_(s)
 		{
-			data_.ul = ul;
+			if (split_log_format(s, [](const LogChunk &) {}) != sizeof...(A))
+			{
+				log_format_argument_count_mismatch();
+			}
 		}
+	};
 
-		LogElement(LogType type, unsigned long long ull) : type_(type)
+	/// Writes the next encoded argument to out. Returns false if the encoding is truncated or unknown.
+	inline bool format_log_arg(std::ostream &out, const char *&args, const char *end)
+	{
+		LogType type;
+		if (!read_log_arg(args, end, type))
 		{
-			data_.ull = ull;
+			return false;
 		}
 
-		LogElement(LogType type, float f) : type_(type)
+		switch (type)
 		{
-			data_.f = f;
+			case LogType::CHAR:
+			{
+				char c;
+				return read_log_arg(args, end, c) && (out << c);
+			}
+			case LogType::INTEGER:
+			{
+				int i;
+				return read_log_arg(args, end, i) && (out << i);
+			}
+			case LogType::LONG_INTEGER:
+			{
+				long li;
+				return read_log_arg(args, end, li) && (out << li);
+			}
+			case LogType::LONG_LONG_INTEGER:
+			{
+				long long ll;
+				return read_log_arg(args, end, ll) && (out << ll);
+			}
+			case LogType::UNSIGNED_INTEGER:
+			{
+				unsigned u;
+				return read_log_arg(args, end, u) && (out << u);
+			}
+			case LogType::UNSIGNED_LONG_INTEGER:
+			{
+				unsigned long ul;
+				return read_log_arg(args, end, ul) && (out << ul);
+			}
+			case LogType::UNSIGNED_LONG_LONG_INTEGER:
+			{
+				unsigned long long ull;
+				return read_log_arg(args, end, ull) && (out << ull);
+			}
+			case LogType::FLOAT:
+			{
+				float f;
+				return read_log_arg(args, end, f) && (out << f);
+			}
+			case LogType::DOUBLE:
+			{
+				double d;
+				return read_log_arg(args, end, d) && (out << d);
+			}
+			case LogType::STRING:
+			{
+				uint32_t str_len;
+				if (!read_log_arg(args, end, str_len) || static_cast<size_t>(end - args) < str_len)
+				{
+					return false;
+				}
+
+				out.write(args, str_len);
+				args += str_len;
+				return true;
+			}
 		}
 
-		LogElement(LogType type, double d) : type_(type)
+		return false;
+	}
+
+	/// Expands the encoded arguments of one record into out using the pre-split chunks of its format string. Shared
+	/// by the logger thread and the offline decoder. Returns false if the arguments do not match the chunks.
+	inline bool format_log_record(std::ostream &out, const char *fmt, const std::vector<LogChunk> &chunks,
+	                              const char *args, size_t len)
+	{
+		const char *end = args + len;
+
+		for (const LogChunk &chunk : chunks)
 		{
-			data_.d = d;
+			out.write(fmt + chunk.offset_, chunk.len_);
+
+			if (chunk.arg_ && !format_log_arg(out, args, end))
+			{
+				return false;
+			}
 		}
+
+		return args == end;
+	}
+
+	/// How the logger thread waits for records once the queue is empty.
+	enum class LogDrainPolicy : int8_t
+	{
+		BUSY_SPIN = 0,  // never gives up the core, lowest latency, burns a full core
+		SPIN_YIELD = 1, // spins for LOG_SPIN_ITERATIONS then yields the core between polls
+		PARK = 2        // spins then parks on a futex for at most max_wakeup_latency_
 	};
 
-	class Logger final
+	constexpr size_t LOG_SPIN_ITERATIONS = 1024;
+
+	struct LoggerConfig
+	{
+		LogMode mode_ = LogMode::TEXT;
+		LogDrainPolicy drain_policy_ = LogDrainPolicy::PARK;
+		nanos max_wakeup_latency_ = NANOS_TO_MILIS;
+
+		// Lanes are reserved up front but only committed as they fill, unless lane_arena_ asks for prefaulting.
+		size_t lane_capacity_ = LOG_Q_SIZE;
+		ArenaConfig lane_arena_ = {};
+
+		// MMAP writes <file_name>.0, <file_name>.1, ... segments of segment_size_ bytes.
+		LogSinkType sink_ = LogSinkType::FILE;
+		size_t segment_size_ = 64 * 1024 * 1024;
+		nanos rotate_interval_ = 0; // 0 rotates on size only
+		LogSyncPolicy sync_policy_ = LogSyncPolicy::ON_ROTATE;
+
+		// IO_URING writes through a ring set up with this, SQPOLL takes even the submits off the logger thread.
+		IoUringConfig uring_ = {.entries_ = 16};
+	};
+
+	struct LoggerStats
+	{
+		uint64_t records_drained_ = 0;
+		uint64_t bytes_written_ = 0;
+		uint64_t dropped_records_ = 0;
+		uint64_t queue_high_water_mark_ = 0;
+		uint64_t flushes_ = 0;
+		uint64_t lanes_ = 0; // one per thread that ever logged
+		double drain_rate_ = 0; // records per second since construction
+	};
+
+	/* One single-producer lane of a Logger. A thread gets its own lane the first time it logs, so several threads can
+	 * share one Logger while every producer only ever writes to its own LFQueue and counters. The logger thread is
+	 * the single consumer of all lanes and reassembles multi-slot records in the lane's scratch buffer.
+	 */
+	class LogLane final
 	{
+	public:
+		LFQueue<LogRecord> queue_;
+
+		// Written by the owning producer only, read by Logger::stats().
+		std::atomic<uint64_t> dropped_records_ = 0;
+
+		// Set once by Logger::register_lane, a thread finds its lane again after its cache entry was evicted.
+		pthread_t thread_ {};
+
+		// Consumer side: the slots taken in one drain pass and how far the merge got through them.
+		LFQSpans<const LogRecord> view_;
+		size_t view_pos_ = 0;
+		std::vector<char> scratch_;
+		const char *pending_fmt_ = nullptr;
+		nanos pending_ts_ = 0;
+
 	private:
-		const std::string file_name_;
-		std::ofstream file_;
-		LFQueue<LogElement> queue_;
-		std::atomic<bool> running_ = true;
-		std::thread *logger_thread_ = nullptr;
+		// Producer side: the slots claimed by log() and the one currently being filled.
+		LFQSpans<LogRecord> claimed_;
+		size_t claimed_idx_ = 0;
+		LogRecord *record_ = nullptr;
 
 	public:
-		explicit Logger(const std::string &file_name) : file_name_(file_name), queue_(LOG_Q_SIZE)
+		LogLane(size_t capacity, const ArenaConfig &arena) : queue_(capacity, LFQOverflow::FAIL_FAST, arena)
 		{
-			file_.open(file_name);
-			ASSERT(file_.is_open(), "Could not open log file: " + file_name);
-			logger_thread_ = launch_thread(-1, "Common/Logger", [this]()
-			{
-				flush_queue();
-			});
-			ASSERT(logger_thread_ != nullptr, "Failed to start logger thread");
+			scratch_.reserve(4 * LOG_RECORD_PAYLOAD);
 		}
 
-		~Logger()
-		{
-			std::cerr << "Flushing and closing logger for " << file_name_ << '\n';
+		LogLane() = delete;
 
-			while (queue_.size())
-			{
-				using namespace std::literals::chrono_literals;
-				std::this_thread::sleep_for(1s);
-			}
+		LogLane(const LogLane &) = delete;
 
-			running_ = false;
+		LogLane(const LogLane &&) = delete;
 
-			file_.close();
-		}
+		LogLane &operator=(const LogLane &) = delete;
 
-		Logger() = delete;
+		LogLane &operator=(const LogLane &&) = delete;
 
-		Logger(const Logger &) = delete;
+		template<typename... A>
+		void log(const char *fmt, const A &... args) noexcept
+		{
+			const size_t bytes = (static_cast<size_t>(0) + ... + log_arg_size(args));
+			const size_t slots = bytes ? (bytes + LOG_RECORD_PAYLOAD - 1) / LOG_RECORD_PAYLOAD : 1;
 
-		Logger(const Logger &&) = delete;
+			// All slots of a record are claimed together and published with one store, so the consumer never sees
+			// half a record.
+			claimed_ = queue_.get_next_write_locs(slots);
+			if (claimed_.size() < slots) [[unlikely]]
+			{
+				dropped_records_.store(dropped_records_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				return;
+			}
 
-		Logger &operator=(const Logger &) = delete;
+			begin_record(fmt);
+			(push_value(args), ...);
+			queue_.update_write_idx(claimed_idx_ + 1);
+		}
 
-		Logger &operator=(const Logger &&) = delete;
+	private:
+		void begin_record(const char *s) noexcept
+		{
+			claimed_idx_ = 0;
+			record_ = &claimed_[0];
+			record_->ts_ = get_ns();
+			record_->fmt_ = s;
+			record_->len_ = 0;
+			record_->more_ = false;
+		}
 
-		void flush_queue() noexcept
+		void push_bytes(const void *src, size_t n) noexcept
 		{
-			while (running_)
+			const char *bytes = static_cast<const char *>(src);
+
+			while (n)
 			{
-				for (const LogElement *next = queue_.get_next_to_read();
-				     queue_.size() && next; next = queue_.get_next_to_read())
+				if (record_->len_ == LOG_RECORD_PAYLOAD) [[unlikely]]
 				{
-					switch (next->type_)
-					{
-						case LogType::CHAR:
-							file_ << next->data_.c;
-							break;
-						case LogType::INTEGER:
-							file_ << next->data_.i;
-							break;
-						case LogType::LONG_INTEGER:
-							file_ << next->data_.li;
-							break;
-						case LogType::LONG_LONG_INTEGER:
-							file_ << next->data_.ll;
-							break;
-						case LogType::UNSIGNED_INTEGER:
-							file_ << next->data_.u;
-							break;
-						case LogType::UNSIGNED_LONG_INTEGER:
-							file_ << next->data_.ul;
-							break;
-						case LogType::UNSIGNED_LONG_LONG_INTEGER:
-							file_ << next->data_.ull;
-							break;
-						case LogType::FLOAT:
-							file_ << next->data_.f;
-							break;
-						case LogType::DOUBLE:
-							file_ << next->data_.d;
-							break;
-					}
-					queue_.update_read_idx();
+					record_->more_ = true;
+					record_ = &claimed_[++claimed_idx_];
+					record_->fmt_ = nullptr;
+					record_->len_ = 0;
+					record_->more_ = false;
 				}
 
-				using namespace std::literals::chrono_literals;
-				std::this_thread::sleep_for(1s);
+				const size_t count = std::min(n, LOG_RECORD_PAYLOAD - record_->len_);
+				memcpy(record_->payload_ + record_->len_, bytes, count);
+				record_->len_ += count;
+				bytes += count;
+				n -= count;
 			}
 		}
 
-		void push_value(const LogElement& log_element) noexcept
+		template<typename T>
+		static constexpr typename std::enable_if<is_matching<T>, size_t>::type log_arg_size(const T &) noexcept
+		{
+			return sizeof(LogType) + (std::is_same_v<T, bool> ? sizeof(int) : sizeof(T));
+		}
+
+		static size_t log_arg_size(const char *value) noexcept
+		{
+			return sizeof(LogType) + sizeof(uint32_t) + strlen(value);
+		}
+
+		static size_t log_arg_size(const std::string &value) noexcept
+		{
+			return sizeof(LogType) + sizeof(uint32_t) + value.size();
+		}
+
+		template<typename V>
+		void push_arg(LogType type, const V &value) noexcept
 		{
-			*(queue_.get_next_write_loc()) = log_element;
-			queue_.update_write_idx();
+			push_bytes(&type, sizeof(type));
+			push_bytes(&value, sizeof(value));
 		}
 
 		/* SFINAE for compile time branching for log element construction. The literature decides to use function
@@ -280,101 +509,416 @@ namespace Common
 		{
 			if constexpr (std::is_same_v<T, char>)
 			{
-				push_value(LogElement {LogType::CHAR, value});
+				push_arg(LogType::CHAR, value);
 			}
 			else if constexpr (std::is_same_v<T, int>)
 			{
-				push_value(LogElement {LogType::INTEGER, value});
+				push_arg(LogType::INTEGER, value);
 			}
 			else if constexpr (std::is_same_v<T, long>)
 			{
-				push_value(LogElement {LogType::LONG_INTEGER, value});
+				push_arg(LogType::LONG_INTEGER, value);
 			}
 			else if constexpr (std::is_same_v<T, long long>)
 			{
-				push_value(LogElement {LogType::LONG_LONG_INTEGER, value});
+				push_arg(LogType::LONG_LONG_INTEGER, value);
 			}
 			else if constexpr (std::is_same_v<T, unsigned>)
 			{
-				push_value(LogElement {LogType::UNSIGNED_INTEGER, value});
+				push_arg(LogType::UNSIGNED_INTEGER, value);
 			}
 			else if constexpr (std::is_same_v<T, unsigned long>)
 			{
-				push_value(LogElement {LogType::UNSIGNED_LONG_INTEGER, value});
+				push_arg(LogType::UNSIGNED_LONG_INTEGER, value);
 			}
 			else if constexpr (std::is_same_v<T, unsigned long long>)
 			{
-				push_value(LogElement {LogType::UNSIGNED_LONG_LONG_INTEGER, value});
+				push_arg(LogType::UNSIGNED_LONG_LONG_INTEGER, value);
 			}
 			else if constexpr (std::is_same_v<T, float>)
 			{
-				push_value(LogElement {LogType::FLOAT, value});
+				push_arg(LogType::FLOAT, value);
 			}
 			else if constexpr (std::is_same_v<T, double>)
 			{
-				push_value(LogElement {LogType::DOUBLE, value});
+				push_arg(LogType::DOUBLE, value);
 			}
 			else if constexpr (std::is_same_v<T, bool>)
 			{
-				push_value(LogElement {LogType::INTEGER, static_cast<int>(value)});
+				push_arg(LogType::INTEGER, static_cast<int>(value));
 			}
 		}
 
+		void push_string(const char *value, uint32_t len) noexcept
+		{
+			const LogType type = LogType::STRING;
+			push_bytes(&type, sizeof(type));
+			push_bytes(&len, sizeof(len));
+			push_bytes(value, len);
+		}
+
 		void push_value(const char *value) noexcept
 		{
-			while (*value)
+			push_string(value, static_cast<uint32_t>(strlen(value)));
+		}
+
+		void push_value(const std::string &value) noexcept
+		{
+			push_string(value.data(), static_cast<uint32_t>(value.size()));
+		}
+	};
+
+	class Logger final
+	{
+	private:
+		const std::string file_name_;
+		const LoggerConfig config_;
+		const uint64_t id_;
+		std::unique_ptr<LogSink> sink_;
+		std::ostream out_;
+		std::atomic<bool> running_ = true;
+		std::atomic<uint32_t> wake_word_ = 0;
+		std::thread *logger_thread_ = nullptr;
+
+		// Lanes are only ever appended, lane_count_ publishes a new lane to the logger thread.
+		LogLane *lanes_[LOG_MAX_LANES] = {};
+		std::atomic<size_t> lane_count_ = 0;
+		std::mutex lanes_mutex_;
+
+		// Consumer side.
+		const nanos start_ns_ = get_ns();
+		std::atomic<uint64_t> records_drained_ = 0;
+		std::atomic<uint64_t> queue_high_water_mark_ = 0;
+
+		struct FormatInfo
+		{
+			uint32_t id_;
+			std::vector<LogChunk> chunks_;
+		};
+
+		// Split once per format string the first time the logger thread sees it.
+		std::unordered_map<const char *, FormatInfo> formats_;
+
+		struct LaneCacheEntry
+		{
+			uint64_t logger_id_ = 0;
+			LogLane *lane_ = nullptr;
+		};
+
+		static inline std::atomic<uint64_t> next_logger_id_ = 1;
+
+	public:
+		explicit Logger(const std::string &file_name, const LoggerConfig &config = {}) : file_name_(file_name),
+			config_(config), id_(next_logger_id_.fetch_add(1)), sink_(make_sink(file_name, config)),
+			out_(sink_.get())
+		{
+			if (config_.mode_ == LogMode::BINARY)
 			{
-				push_value(*value++);
+				out_.write(LOG_BINARY_MAGIC, sizeof(LOG_BINARY_MAGIC));
 			}
+
+			logger_thread_ = launch_thread(-1, "Common/Logger", [this]()
+			{
+				flush_queue();
+			});
+			ASSERT(logger_thread_ != nullptr, "Failed to start logger thread");
 		}
 
-		void push_value(const std::string &value) noexcept {
-			for (const char &c : value)
+		~Logger()
+		{
+			std::cerr << "Flushing and closing logger for " << file_name_ << '\n';
+
+			// The logger thread drains whatever is left before it returns.
+			running_ = false;
+			wake_word_.fetch_add(1, std::memory_order_release);
+			unpark_threads(wake_word_);
+
+			logger_thread_->join();
+			delete logger_thread_;
+
+			for (size_t i = 0; i < lane_count_.load(); i++)
 			{
-				push_value(c);
+				delete lanes_[i];
 			}
 		}
 
-		template<typename T, typename... A>
-		void log(const char *s, const T &value, A... args) noexcept
+		Logger() = delete;
+
+		Logger(const Logger &) = delete;
+
+		Logger(const Logger &&) = delete;
+
+		Logger &operator=(const Logger &) = delete;
+
+		Logger &operator=(const Logger &&) = delete;
+
+		void flush_queue() noexcept
 		{
-			while (*s)
+			size_t idle_polls = 0;
+
+			while (true)
 			{
-				if (*s == '%')
+				const bool running = running_.load(std::memory_order_acquire);
+				const size_t drained = drain();
+
+				if (drained)
 				{
-					if ((*(s + 1) == '%')) [[unlikely]]
-					{
-						s++;
-					}
-					else
-					{
-						push_value(value);
-						log(s + 1, args...);
-						return;
-					}
+					idle_polls = 0;
+					continue;
+				}
+
+				if (!running)
+				{
+					break;
+				}
+
+				// Queue empty: push out what was staged, then wait according to the policy.
+				if (idle_polls == 0)
+				{
+					out_.flush();
+				}
+				idle_polls++;
+
+				if (config_.drain_policy_ == LogDrainPolicy::BUSY_SPIN || idle_polls < LOG_SPIN_ITERATIONS)
+				{
+					continue;
+				}
+
+				if (config_.drain_policy_ == LogDrainPolicy::SPIN_YIELD)
+				{
+					std::this_thread::yield();
+				}
+				else
+				{
+					park_thread(wake_word_, wake_word_.load(std::memory_order_acquire), config_.max_wakeup_latency_);
 				}
-				push_value(*s++);
 			}
-			FATAL("extra arguments provided to log()");
+
+			out_.flush();
 		}
 
-		void log(const char *s) noexcept
+		/// Pushes one record holding the format string, a timestamp and the raw argument bytes into the calling
+		/// thread's lane. The formatting happens on the logger thread (TEXT) or offline (BINARY), so the cost here is
+		/// O(argument count) and the placeholder count was already checked against the arguments at compile time.
+		/// The record is dropped and counted if the lane does not have room for it.
+		template<typename... A>
+		void log(std::type_identity_t<LogFormat<A...>> fmt, const A &... args) noexcept
 		{
-			while (*s)
+			local_lane().log(fmt.str_, args...);
+		}
+
+		[[nodiscard]] LoggerStats stats() const noexcept
+		{
+			LoggerStats stats;
+			stats.records_drained_ = records_drained_.load(std::memory_order_relaxed);
+			stats.bytes_written_ = sink_->bytes_written();
+			stats.queue_high_water_mark_ = queue_high_water_mark_.load(std::memory_order_relaxed);
+			stats.flushes_ = sink_->flushes();
+
+			const size_t lane_count = lane_count_.load(std::memory_order_acquire);
+			stats.lanes_ = lane_count;
+			for (size_t i = 0; i < lane_count; i++)
 			{
-				if (*s == '%')
+				stats.dropped_records_ += lanes_[i]->dropped_records_.load(std::memory_order_relaxed);
+			}
+
+			const nanos elapsed = get_ns() - start_ns_;
+			stats.drain_rate_ = elapsed > 0 ? static_cast<double>(stats.records_drained_) * NANOS_TO_SECS / elapsed : 0;
+			return stats;
+		}
+
+	private:
+		static std::unique_ptr<LogSink> make_sink(const std::string &file_name, const LoggerConfig &config)
+		{
+			if (config.sink_ == LogSinkType::MMAP)
+			{
+				return std::make_unique<LogMmapSink>(file_name, config.segment_size_, config.rotate_interval_,
+				                                     config.sync_policy_);
+			}
+#ifndef __APPLE__
+			if (config.sink_ == LogSinkType::IO_URING)
+			{
+				auto sink = std::make_unique<LogUringSink>(file_name, config.uring_);
+				if (sink->valid())
 				{
-					if ((*(s + 1) == '%')) [[unlikely]]
-					{
-						s++;
-					}
-					else
+					return sink;
+				}
+				std::cerr << "Logger io_uring unavailable for " << file_name << ", writing with writev()\n";
+			}
+#endif
+
+			return std::make_unique<LogFileSink>(file_name);
+		}
+
+		/// Finds the calling thread's lane through a small thread_local cache keyed on the logger id, ids are never
+		/// reused so entries left behind by destroyed loggers can not match.
+		LogLane &local_lane() noexcept
+		{
+			thread_local LaneCacheEntry cache[LOG_LANE_CACHE_SIZE];
+			thread_local size_t next_victim = 0;
+
+			for (const LaneCacheEntry &entry : cache)
+			{
+				if (entry.logger_id_ == id_) [[likely]]
+				{
+					return *entry.lane_;
+				}
+			}
+
+			LaneCacheEntry &entry = cache[next_victim];
+			next_victim = (next_victim + 1) % LOG_LANE_CACHE_SIZE;
+			entry.logger_id_ = id_;
+			entry.lane_ = register_lane();
+			return *entry.lane_;
+		}
+
+		/// Slow path, once per thread (again after its cache entry was evicted, which finds the existing lane).
+		LogLane *register_lane()
+		{
+			std::lock_guard<std::mutex> lock(lanes_mutex_);
+
+			const size_t lane_count = lane_count_.load(std::memory_order_relaxed);
+			for (size_t i = 0; i < lane_count; i++)
+			{
+				if (pthread_equal(lanes_[i]->thread_, pthread_self()))
+				{
+					return lanes_[i];
+				}
+			}
+			ASSERT(lane_count < LOG_MAX_LANES, "Too many threads logging to " + file_name_);
+
+			lanes_[lane_count] = new LogLane(config_.lane_capacity_, config_.lane_arena_);
+			lanes_[lane_count]->thread_ = pthread_self();
+			lane_count_.store(lane_count + 1, std::memory_order_release);
+			return lanes_[lane_count];
+		}
+
+		/// Consumes every record currently in the lanes, always taking the lane whose head record has the oldest
+		/// timestamp so the file stays in time order across threads. Each lane is read through one batch view and
+		/// released with one store at the end of the pass. Returns the number of slots consumed.
+		size_t drain() noexcept
+		{
+			const size_t lane_count = lane_count_.load(std::memory_order_acquire);
+			size_t drained = 0;
+
+			for (size_t i = 0; i < lane_count; i++)
+			{
+				LogLane *lane = lanes_[i];
+				lane->view_ = lane->queue_.get_all_to_read();
+				lane->view_pos_ = 0;
+
+				if (lane->view_.size() > queue_high_water_mark_.load(std::memory_order_relaxed))
+				{
+					queue_high_water_mark_.store(lane->view_.size(), std::memory_order_relaxed);
+				}
+			}
+
+			while (true)
+			{
+				LogLane *oldest = nullptr;
+
+				for (size_t i = 0; i < lane_count; i++)
+				{
+					LogLane *lane = lanes_[i];
+
+					if (lane->view_pos_ < lane->view_.size() &&
+					    (!oldest || lane->view_[lane->view_pos_].ts_ < oldest->view_[oldest->view_pos_].ts_))
 					{
-						FATAL("missing arguments to log()");
+						oldest = lane;
 					}
 				}
-				push_value(*s++);
+
+				if (!oldest)
+				{
+					break;
+				}
+
+				// One whole record, producers publish all of its slots at once.
+				bool more = true;
+				while (more && oldest->view_pos_ < oldest->view_.size())
+				{
+					const LogRecord &record = oldest->view_[oldest->view_pos_++];
+					more = record.more_;
+					consume_record(*oldest, record);
+				}
 			}
+
+			for (size_t i = 0; i < lane_count; i++)
+			{
+				LogLane *lane = lanes_[i];
+
+				if (lane->view_pos_)
+				{
+					lane->queue_.update_read_idx(lane->view_pos_);
+					drained += lane->view_pos_;
+				}
+			}
+
+			return drained;
+		}
+
+		void consume_record(LogLane &lane, const LogRecord &record)
+		{
+			if (lane.scratch_.empty())
+			{
+				lane.pending_fmt_ = record.fmt_;
+				lane.pending_ts_ = record.ts_;
+			}
+
+			lane.scratch_.insert(lane.scratch_.end(), record.payload_, record.payload_ + record.len_);
+
+			if (record.more_)
+			{
+				return;
+			}
+
+			auto it = formats_.find(lane.pending_fmt_);
+
+			if (it == formats_.end()) [[unlikely]]
+			{
+				it = formats_.emplace(lane.pending_fmt_, FormatInfo {static_cast<uint32_t>(formats_.size()),
+				                                                     split_log_format(lane.pending_fmt_)}).first;
+
+				if (config_.mode_ == LogMode::BINARY)
+				{
+					write_binary_format(it->second.id_, lane.pending_fmt_);
+				}
+			}
+
+			if (config_.mode_ == LogMode::TEXT)
+			{
+				if (!format_log_record(out_, lane.pending_fmt_, it->second.chunks_, lane.scratch_.data(),
+				                       lane.scratch_.size()))
+				{
+					FATAL("Malformed log record");
+				}
+			}
+			else
+			{
+				write_binary_record(it->second.id_, lane);
+			}
+
+			records_drained_.fetch_add(1, std::memory_order_relaxed);
+			lane.scratch_.clear();
+		}
+
+		void write_binary_format(uint32_t id, const char *fmt)
+		{
+			const uint32_t fmt_len = static_cast<uint32_t>(strlen(fmt));
+			out_.put(LOG_BINARY_FORMAT);
+			out_.write(reinterpret_cast<const char *>(&id), sizeof(id));
+			out_.write(reinterpret_cast<const char *>(&fmt_len), sizeof(fmt_len));
+			out_.write(fmt, fmt_len);
+		}
+
+		void write_binary_record(uint32_t id, const LogLane &lane)
+		{
+			const uint32_t len = static_cast<uint32_t>(lane.scratch_.size());
+			out_.put(LOG_BINARY_RECORD);
+			out_.write(reinterpret_cast<const char *>(&id), sizeof(id));
+			out_.write(reinterpret_cast<const char *>(&lane.pending_ts_), sizeof(lane.pending_ts_));
+			out_.write(reinterpret_cast<const char *>(&len), sizeof(len));
+			out_.write(lane.scratch_.data(), len);
 		}
 	};
 }
@@ -3,77 +3,150 @@
 
 #include <string>
 #include <iostream>
-#include <vector>
-
+#include <memory>
+#include <span>
+#include <bit>
+
+#include "macros.h"
+
+/* Fixed size window over the last max_size elements pushed: a full buffer drops its oldest element to make room.
+ *
+ * Slots are a power of two so positions wrap with a mask, and every element is written twice, at its slot and one
+ * capacity further on. Whatever the wrap position the live elements then sit back to back somewhere in the doubled
+ * store, so window() is always a single contiguous span a batch kernel can run over.
+ *
+ * Elements are indexed from the oldest, [0] is front() and [size() - 1] is back(). pop_back() makes it usable as a
+ * bounded deque as well.
+ */
 template <typename T>
 class RingBuffer
 {
 private:
-    T* buffer_;
-    size_t head_ = 0; //write pointer
-    size_t tail_ = 0; //read pointer
-    size_t capacity_;
-
-public:
-    explicit RingBuffer(const size_t sz)
+    const size_t max_size_;
+    const size_t capacity_;
+    const size_t mask_;
+    std::unique_ptr<T[]> buffer_;
+    size_t head_ = 0; // elements ever pushed
+    size_t tail_ = 0; // elements ever dropped or popped
+
+    T& slot(size_t pos) const
     {
-        buffer_ = new T[sz];
-        capacity_ = sz;
+        return buffer_[pos & mask_];
     }
 
-    ~RingBuffer()
+public:
+    explicit RingBuffer(const size_t sz) : max_size_(sz), capacity_(std::bit_ceil(sz)), mask_(capacity_ - 1),
+        buffer_(new T[2 * capacity_])
     {
-        delete[] buffer_;
+        ASSERT(sz != 0, "RingBuffer needs room for at least one element");
     }
 
-    void push_back(const T data)
-    {
-        buffer_[head_] = data;
+    RingBuffer() = delete;
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer(const RingBuffer&&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&&) = delete;
 
-        if (head_ == capacity_ - 1)
-        {
-            head_ = 0;
-        }
-        else
+    /// Appends data, dropping the oldest element when the window is full.
+    void push_back(const T& data)
+    {
+        if (full())
         {
-            head_++;
+            tail_++;
         }
+
+        const size_t idx = head_ & mask_;
+        buffer_[idx] = data;
+        buffer_[idx + capacity_] = data;
+        head_++;
     }
 
+    /// Removes and returns the oldest element.
     T top()
     {
-        T res = buffer_[tail_];
+        T res = front();
+        pop_front();
+        return res;
+    }
 
-        if (tail_ == capacity_ - 1)
-        {
-            tail_ = 0;
-        }
-        else
-        {
-            tail_++;
-        }
+    void pop_front()
+    {
+        ASSERT(!empty(), "pop_front() on an empty RingBuffer");
+        tail_++;
+    }
 
-        return res;
+    void pop_back()
+    {
+        ASSERT(!empty(), "pop_back() on an empty RingBuffer");
+        head_--;
+    }
+
+    const T& front() const
+    {
+        ASSERT(!empty(), "front() on an empty RingBuffer");
+        return slot(tail_);
+    }
+
+    const T& back() const
+    {
+        ASSERT(!empty(), "back() on an empty RingBuffer");
+        return slot(head_ - 1);
+    }
+
+    /// The live elements oldest first, contiguous in memory.
+    std::span<const T> window() const
+    {
+        return std::span<const T>(&buffer_[tail_ & mask_], size());
     }
 
     [[nodiscard]] size_t size() const
     {
-        return capacity_;
+        return head_ - tail_;
     }
 
-    void clear()
+    [[nodiscard]] size_t max_size() const
     {
-        memset(buffer_, 0, capacity_ * sizeof(T));
+        return max_size_;
     }
 
-    T operator[](const size_t iter)
+    [[nodiscard]] bool empty() const
     {
-        if (iter < capacity_)
-        {
-            return buffer_[iter];
-        }
+        return head_ == tail_;
+    }
+
+    [[nodiscard]] bool full() const
+    {
+        return size() == max_size_;
+    }
 
-        return NULL;
+    /// Elements ever pushed, the position the next push_back() gets.
+    [[nodiscard]] size_t end_pos() const
+    {
+        return head_;
+    }
+
+    /// Position of front(), positions only grow so they can be kept to refer back to an element.
+    [[nodiscard]] size_t begin_pos() const
+    {
+        return tail_;
+    }
+
+    /// The element at position pos, which must still be in the window.
+    const T& at_pos(size_t pos) const
+    {
+        ASSERT(pos >= tail_ && pos < head_, "RingBuffer position outside the window");
+        return slot(pos);
+    }
+
+    void clear()
+    {
+        tail_ = head_;
+    }
+
+    const T& operator[](const size_t iter) const
+    {
+        ASSERT(iter < size(), "RingBuffer index out of range");
+        return slot(tail_ + iter);
     }
 
     void print_top()
@@ -58,6 +58,7 @@ void basic_main()
 
 //Order Book example
 #include <vector>
+#include "order_book.h"
 
 struct Order
 {
@@ -163,4 +164,16 @@ void order_book_ex()
     CRTPOrderBook<SpecificCRTPOrderBook> crtp_ex;
     crtp_ex.place_order();
     delete runtime_ex;
+
+    // The real thing: order_book.h
+    Common::OrderBook book(1024, 256, 1024);
+    book.add(1, Common::Side::BUY, 9999, 100);
+    book.add(2, Common::Side::BUY, 9999, 50);
+    book.add(3, Common::Side::SELL, 10001, 75);
+    book.modify(1, 9998, 100);
+    book.execute(3, 25);
+
+    const Common::BBO bbo = book.bbo();
+    std::cout << "\nBBO: " << bbo.bid_qty_ << " @ " << bbo.bid_price_ << " / " << bbo.ask_qty_ << " @ "
+        << bbo.ask_price_ << '\n';
 }
\ No newline at end of file
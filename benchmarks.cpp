@@ -0,0 +1,1775 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <unordered_map>
+#include <array>
+#include <cstring>
+#include <memory>
+#include <optional>
+
+#include "benchmarks.h"
+#include "Logger.h"
+#include "lock_free_q.h"
+#include "mpmc_q.h"
+#include "broadcast_ring.h"
+#include "mem_pool.h"
+#include "concurrent_mem_pool.h"
+#include "rolling_window.h"
+#include "order_book.h"
+#include "matching_engine.h"
+#include "flat_tables.h"
+#include "feed_handler.h"
+#include "md_publisher.h"
+#include "tcp_server.h"
+#include "io_uring.h"
+#include "socket_utils.h"
+#include "time_utils.h"
+
+// Construction cost of a Logger and the first log() from a thread, which is when that thread's lane gets reserved.
+void logger_startup_bench()
+{
+	using namespace Common;
+
+	constexpr int loggers = 8;
+
+	for (int i = 0; i < loggers; i++)
+	{
+		const std::string file_name = "startup_bench_" + std::to_string(i) + ".txt";
+
+		const nanos start = get_ns();
+		Logger logger(file_name);
+		const nanos constructed = get_ns();
+		logger.log("first record from logger %\n", i);
+		const nanos first_log = get_ns();
+
+		std::cout << "Logger " << i << " construction: " << (constructed - start) / NANOS_TO_MICROS
+			<< "us first log(): " << (first_log - constructed) / NANOS_TO_MICROS << "us\n";
+	}
+}
+
+template<typename Q, typename F>
+static double time_pops(Q &q, size_t count, F &&on_pop)
+{
+	using namespace Common;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		*q.get_next_write_loc() = i;
+		q.update_write_idx();
+	}
+
+	const nanos start = get_ns();
+	size_t sum = 0;
+	for (const size_t *next = q.get_next_to_read(); next; next = q.get_next_to_read())
+	{
+		sum += *next;
+		on_pop();
+		q.update_read_idx();
+	}
+	const nanos elapsed = get_ns() - start;
+
+	ASSERT(sum == count * (count - 1) / 2, "LFQueue bench lost elements");
+	return static_cast<double>(elapsed) / count;
+}
+
+// Per element cost of consuming from an LFQueue: release (unchecked), checked, and the thread name lookup plus
+// std::string the old update_read_idx() paid on every pop.
+void lfq_pop_bench()
+{
+	constexpr size_t count = 1 << 20;
+
+	LFQueue<size_t, false> release_q(count);
+	LFQueue<size_t, true> checked_q(count);
+	LFQueue<size_t, false> legacy_q(count);
+
+	const double release_ns = time_pops(release_q, count, []() {});
+	const double checked_ns = time_pops(checked_q, count, []() {});
+	const double legacy_ns = time_pops(legacy_q, count, []()
+	{
+		char thread_name[64];
+		pthread_getname_np(pthread_self(), thread_name, sizeof(thread_name));
+		std::string thread_name_str(thread_name);
+		asm volatile("" : : "r"(thread_name_str.data()) : "memory");
+	});
+
+	std::cout << "LFQueue pop release: " << release_ns << "ns checked: " << checked_ns
+		<< "ns with per-pop thread name lookup: " << legacy_ns << "ns\n";
+}
+
+// Producer/consumer throughput moving messages one slot at a time versus claiming and committing batches of 64 slots
+// with a single index store per batch on each side.
+void lfq_batch_bench()
+{
+	using namespace Common;
+
+	static constexpr size_t count = 1 << 24;
+	static constexpr size_t batch = 64;
+
+	auto run = [](bool batched)
+	{
+		LFQueue<size_t, false> q(64 * 1024);
+		size_t sum = 0;
+
+		const nanos start = get_ns();
+		std::thread consumer([&q, &sum, batched]()
+		{
+			size_t received = 0;
+			while (received < count)
+			{
+				if (batched)
+				{
+					const LFQSpans<const size_t> available = q.get_all_to_read();
+					for (size_t i = 0; i < available.size(); i++)
+					{
+						sum += available[i];
+					}
+					if (!available.empty())
+					{
+						q.update_read_idx(available.size());
+						received += available.size();
+					}
+				}
+				else if (const size_t *next = q.get_next_to_read())
+				{
+					sum += *next;
+					q.update_read_idx();
+					received++;
+				}
+			}
+		});
+
+		for (size_t sent = 0; sent < count;)
+		{
+			if (batched)
+			{
+				const LFQSpans<size_t> slots = q.get_next_write_locs(std::min(batch, count - sent));
+				for (size_t i = 0; i < slots.size(); i++)
+				{
+					slots[i] = sent + i;
+				}
+				q.update_write_idx(slots.size());
+				sent += slots.size();
+			}
+			else if (q.can_write())
+			{
+				*q.get_next_write_loc() = sent++;
+				q.update_write_idx();
+			}
+		}
+
+		consumer.join();
+		const nanos elapsed = get_ns() - start;
+
+		ASSERT(sum == count * (count - 1) / 2, "LFQueue batch bench lost elements");
+		return static_cast<double>(elapsed) / count;
+	};
+
+	const double single_ns = run(false);
+	const double batched_ns = run(true);
+	std::cout << "LFQueue per message single slot: " << single_ns << "ns batches of " << batch << ": " << batched_ns
+		<< "ns\n";
+}
+
+struct QueueBenchMsg
+{
+	Common::nanos ts_ = 0;
+	size_t seq_ = 0;
+};
+
+// Runs producers x consumers threads moving count messages through push/pop and prints throughput and the 50th, 99th
+// and 99.9th percentile of push-to-pop latency.
+template<typename Push, typename Pop>
+static void run_queue_bench(const char *name, size_t threads, size_t count, Push &&push, Pop &&pop)
+{
+	using namespace Common;
+
+	std::vector<std::vector<nanos>> latencies(threads);
+	std::atomic<size_t> consumed = {0};
+	std::vector<std::thread> workers;
+
+	const nanos start = get_ns();
+
+	for (size_t c = 0; c < threads; c++)
+	{
+		latencies[c].reserve(count);
+		workers.emplace_back([&, c]()
+		{
+			QueueBenchMsg msg;
+			while (consumed.load(std::memory_order_relaxed) < count)
+			{
+				if (pop(msg))
+				{
+					latencies[c].push_back(get_ns() - msg.ts_);
+					consumed.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+		});
+	}
+
+	for (size_t p = 0; p < threads; p++)
+	{
+		workers.emplace_back([&, p]()
+		{
+			for (size_t i = p; i < count; i += threads)
+			{
+				push(QueueBenchMsg {get_ns(), i});
+			}
+		});
+	}
+
+	for (std::thread &worker : workers)
+	{
+		worker.join();
+	}
+
+	const nanos elapsed = get_ns() - start;
+
+	std::vector<nanos> all;
+	all.reserve(count);
+	for (const std::vector<nanos> &samples : latencies)
+	{
+		all.insert(all.end(), samples.begin(), samples.end());
+	}
+	std::sort(all.begin(), all.end());
+
+	std::cout << name << " " << threads << "P/" << threads << "C: "
+		<< static_cast<double>(count) * NANOS_TO_SECS / elapsed / 1e6 << " Mmsg/s p50: " << all[all.size() / 2]
+		<< "ns p99: " << all[all.size() * 99 / 100] << "ns p99.9: " << all[all.size() * 999 / 1000] << "ns\n";
+}
+
+// MPMCQueue at 1, 2, 4 and 8 producer/consumer pairs against the SPSC LFQueue.
+void mpmc_bench()
+{
+	constexpr size_t count = 1 << 20;
+	constexpr size_t capacity = 64 * 1024;
+
+	{
+		LFQueue<QueueBenchMsg> spsc(capacity);
+		run_queue_bench("LFQueue", 1, count, [&spsc](const QueueBenchMsg &msg)
+		{
+			spsc.try_push(msg);
+		}, [&spsc](QueueBenchMsg &msg)
+		{
+			const QueueBenchMsg *next = spsc.get_next_to_read();
+			if (!next)
+			{
+				return false;
+			}
+			msg = *next;
+			spsc.update_read_idx();
+			return true;
+		});
+	}
+
+	for (const size_t threads : {1, 2, 4, 8})
+	{
+		MPMCQueue<QueueBenchMsg> mpmc(capacity);
+		run_queue_bench("MPMCQueue", threads, count, [&mpmc](const QueueBenchMsg &msg)
+		{
+			mpmc.try_push(msg);
+		}, [&mpmc](QueueBenchMsg &msg)
+		{
+			return mpmc.try_pop(msg);
+		});
+	}
+}
+
+// BroadcastRing with 1, 2 and 4 consumers reading every message, then a recorder gated on two of them. The ring is
+// small enough to wrap thousands of times, every consumer checks it sees each message once and in order and the gated
+// one that it never gets ahead of its dependencies.
+void broadcast_ring_bench()
+{
+	using namespace Common;
+	using Ring = BroadcastRing<QueueBenchMsg>;
+
+	constexpr size_t count = 1 << 20;
+	constexpr size_t capacity = 1024;
+
+	const auto run = [](const char *name, size_t independent, bool gated)
+	{
+		Ring ring(capacity);
+		std::vector<Ring::Consumer *> consumers;
+		for (size_t c = 0; c < independent; c++)
+		{
+			consumers.push_back(&ring.add_consumer());
+		}
+		if (gated)
+		{
+			consumers.push_back(&ring.add_consumer({consumers[0], consumers[1]}));
+		}
+
+		std::vector<std::vector<nanos>> latencies(consumers.size());
+		std::vector<std::thread> workers;
+		const nanos start = get_ns();
+
+		for (size_t c = 0; c < consumers.size(); c++)
+		{
+			latencies[c].reserve(count);
+			workers.emplace_back([&, c]()
+			{
+				Ring::Consumer &consumer = *consumers[c];
+				const bool is_gated = gated && c == consumers.size() - 1;
+				size_t expected = 0;
+
+				while (expected < count)
+				{
+					const LFQSpans<const QueueBenchMsg> ready = consumer.get_all_to_read();
+					if (ready.empty())
+					{
+						continue;
+					}
+
+					const nanos now = get_ns();
+					for (size_t i = 0; i < ready.size(); i++)
+					{
+						ASSERT(ready[i].seq_ == expected++, "BroadcastRing consumer skipped or repeated a message");
+						latencies[c].push_back(now - ready[i].ts_);
+					}
+					ASSERT(!is_gated || (consumers[0]->cursor() >= expected && consumers[1]->cursor() >= expected),
+					       "BroadcastRing gated consumer ran ahead of its dependencies");
+					consumer.update_read_idx(ready.size());
+				}
+			});
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			*ring.get_next_write_loc() = QueueBenchMsg {get_ns(), i};
+			ring.update_write_idx();
+		}
+
+		for (std::thread &worker : workers)
+		{
+			worker.join();
+		}
+
+		const nanos elapsed = get_ns() - start;
+
+		std::vector<nanos> &last = latencies.back();
+		std::sort(last.begin(), last.end());
+		std::cout << "BroadcastRing " << name << " 1P/" << consumers.size() << "C: "
+			<< static_cast<double>(count) * NANOS_TO_SECS / elapsed / 1e6 << " Mmsg/s, " << count / capacity
+			<< " laps, last consumer p50: " << last[last.size() / 2] << "ns p99: " << last[last.size() * 99 / 100]
+			<< "ns p99.9: " << last[last.size() * 999 / 1000] << "ns\n";
+	};
+
+	run("independent", 1, false);
+	run("independent", 2, false);
+	run("independent", 4, false);
+	run("gated", 2, true);
+}
+
+struct PoolBenchObj
+{
+	uint64_t id_ = 0;
+	double price_ = 0;
+	uint32_t qty_ = 0;
+	char side_ = 0;
+};
+
+// Per operation cost of a fragmented pool: fill it, free every fifth block, then time refilling the holes and
+// freeing them again. The same pattern with new/delete as the baseline.
+void mempool_bench()
+{
+	using namespace Common;
+
+	for (const size_t count : {1'000, 10'000, 100'000, 1'000'000, 10'000'000})
+	{
+		const size_t holes = count / 5;
+		std::vector<PoolBenchObj *> objs(count);
+
+		MemPool<PoolBenchObj> pool(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			objs[i] = pool.allocate(PoolBenchObj{i, 0, 0, 0});
+		}
+		for (size_t i = 0; i < count; i += 5)
+		{
+			pool.deallocate(objs[i]);
+		}
+
+		nanos start = get_ns();
+		for (size_t i = 0; i < count; i += 5)
+		{
+			objs[i] = pool.allocate(PoolBenchObj{i, 0, 0, 0});
+		}
+		for (size_t i = 0; i < count; i += 5)
+		{
+			pool.deallocate(objs[i]);
+		}
+		const double pool_ns = static_cast<double>(get_ns() - start) / (2 * holes);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			objs[i] = new PoolBenchObj{i, 0, 0, 0};
+		}
+		for (size_t i = 0; i < count; i += 5)
+		{
+			delete objs[i];
+		}
+
+		start = get_ns();
+		for (size_t i = 0; i < count; i += 5)
+		{
+			objs[i] = new PoolBenchObj{i, 0, 0, 0};
+		}
+		for (size_t i = 0; i < count; i += 5)
+		{
+			delete objs[i];
+		}
+		const double heap_ns = static_cast<double>(get_ns() - start) / (2 * holes);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			if (i % 5 != 0)
+			{
+				delete objs[i];
+			}
+		}
+
+		std::cout << "MemPool " << count << " objects, every fifth free: " << pool_ns << "ns/op new/delete: "
+			<< heap_ns << "ns/op\n";
+	}
+}
+
+// First pass over a freshly constructed 64MB pool (page faults on the hot path unless prefaulted), then a random
+// access pass over the same pool (TLB misses, 4K against 2MB pages).
+void arena_bench()
+{
+	using namespace Common;
+
+	constexpr size_t count = 2'000'000;
+
+	const std::pair<const char *, ArenaConfig> configs[] = {
+		{"first touch", {}},
+		{"prefault", {.prefault_ = true}},
+		{"THP prefault", {.huge_pages_ = HugePages::TRANSPARENT, .prefault_ = true}},
+		{"hugetlb prefault", {.huge_pages_ = HugePages::EXPLICIT, .prefault_ = true}},
+	};
+
+	std::vector<uint32_t> order(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		order[i] = static_cast<uint32_t>(i);
+	}
+	std::shuffle(order.begin(), order.end(), std::mt19937(42));
+
+	for (const auto &[name, config] : configs)
+	{
+		nanos start = get_ns();
+		MemPool<PoolBenchObj> pool(count, config);
+		const nanos construction = get_ns() - start;
+
+		// A fresh pool hands out blocks in index order, so base[i] is the i-th allocation.
+		start = get_ns();
+		const PoolBenchObj *base = pool.allocate(PoolBenchObj{0, 0, 0, 0});
+		for (size_t i = 1; i < count; i++)
+		{
+			pool.allocate(PoolBenchObj{i, 0, 0, 0});
+		}
+		const double first_ns = static_cast<double>(get_ns() - start) / count;
+
+		start = get_ns();
+		uint64_t sum = 0;
+		for (const uint32_t i : order)
+		{
+			sum += base[i].id_;
+		}
+		const double random_ns = static_cast<double>(get_ns() - start) / count;
+		ASSERT(sum == count * (count - 1) / 2, "Arena bench lost objects");
+
+		std::cout << "MemPool " << name << " construction: " << construction / NANOS_TO_MICROS
+			<< "us first allocate pass: " << first_ns << "ns/op random read: " << random_ns << "ns/op\n";
+	}
+}
+
+// Per operation cost of ConcurrentMemPool against MemPool and new/delete: bursts of 64 allocations freed on the same
+// thread, then a gateway thread allocating and a matching thread freeing every object it receives over an LFQueue.
+void concurrent_pool_bench()
+{
+	using namespace Common;
+
+	static constexpr size_t count = 1 << 22;
+	static constexpr size_t burst = 64;
+
+	auto local = [](auto &&allocate, auto &&deallocate)
+	{
+		PoolBenchObj *objs[burst];
+
+		const nanos start = get_ns();
+		for (size_t i = 0; i < count; i += burst)
+		{
+			for (size_t j = 0; j < burst; j++)
+			{
+				objs[j] = allocate(i + j);
+			}
+			for (size_t j = 0; j < burst; j++)
+			{
+				deallocate(objs[j]);
+			}
+		}
+		return static_cast<double>(get_ns() - start) / (2 * count);
+	};
+
+	auto cross_thread = [](auto &&allocate, auto &&deallocate, auto &&flush)
+	{
+		LFQueue<PoolBenchObj *, false> q(64 * 1024);
+		uint64_t sum = 0;
+
+		const nanos start = get_ns();
+		std::thread matcher([&]()
+		{
+			for (size_t received = 0; received < count;)
+			{
+				if (PoolBenchObj *const *next = q.get_next_to_read())
+				{
+					sum += (*next)->id_;
+					deallocate(*next);
+					q.update_read_idx();
+					received++;
+				}
+				else
+				{
+					flush();
+				}
+			}
+			flush();
+		});
+
+		for (size_t sent = 0; sent < count;)
+		{
+			if (q.can_write())
+			{
+				*q.get_next_write_loc() = allocate(sent++);
+				q.update_write_idx();
+			}
+		}
+
+		matcher.join();
+		const nanos elapsed = get_ns() - start;
+
+		ASSERT(sum == count * (count - 1) / 2, "Pool bench lost objects");
+		return static_cast<double>(elapsed) / count;
+	};
+
+	MemPool<PoolBenchObj> pool(burst);
+	ConcurrentMemPool<PoolBenchObj> concurrent_pool(128 * 1024);
+
+	const double pool_ns = local([&pool](size_t i) { return pool.allocate(PoolBenchObj{i, 0, 0, 0}); },
+	                             [&pool](PoolBenchObj *obj) { pool.deallocate(obj); });
+	const double concurrent_ns = local([&concurrent_pool](size_t i)
+	{
+		return concurrent_pool.allocate(PoolBenchObj{i, 0, 0, 0});
+	}, [&concurrent_pool](PoolBenchObj *obj) { concurrent_pool.deallocate(obj); });
+	const double heap_ns = local([](size_t i) { return new PoolBenchObj{i, 0, 0, 0}; },
+	                             [](PoolBenchObj *obj) { delete obj; });
+
+	std::cout << "Same thread allocate/free MemPool: " << pool_ns << "ns/op ConcurrentMemPool: " << concurrent_ns
+		<< "ns/op new/delete: " << heap_ns << "ns/op\n";
+
+	const double concurrent_cross_ns = cross_thread([&concurrent_pool](size_t i)
+	{
+		return concurrent_pool.allocate(PoolBenchObj{i, 0, 0, 0});
+	}, [&concurrent_pool](PoolBenchObj *obj) { concurrent_pool.deallocate(obj); },
+	[&concurrent_pool]() { concurrent_pool.flush(); });
+	const double heap_cross_ns = cross_thread([](size_t i) { return new PoolBenchObj{i, 0, 0, 0}; },
+	                                          [](PoolBenchObj *obj) { delete obj; }, []() {});
+
+	std::cout << "Allocate on gateway, free on matcher ConcurrentMemPool: " << concurrent_cross_ns
+		<< "ns/object new/delete: " << heap_cross_ns << "ns/object\n";
+}
+
+// An order with an inline fill buffer and a heap owning member, constructed in place from its arguments.
+struct PoolBenchOrder
+{
+	uint64_t id_;
+	double price_;
+	uint32_t qty_;
+	std::array<uint64_t, 16> fills_ = {};
+	std::string account_;
+
+	PoolBenchOrder(uint64_t id, double price, uint32_t qty, std::string &&account) : id_(id), price_(price),
+		qty_(qty), account_(std::move(account))
+	{
+	}
+};
+
+// Pool creation for a million orders and the per allocate/deallocate cost of emplacing one, on first touch of the
+// storage and again once it is warm.
+void mempool_construct_bench()
+{
+	using namespace Common;
+
+	constexpr size_t count = 1'000'000;
+
+	nanos start = get_ns();
+	MemPool<PoolBenchOrder> pool(count);
+	const nanos construction = get_ns() - start;
+
+	std::cout << "MemPool " << count << " orders of " << sizeof(PoolBenchOrder) << " bytes, construction: "
+		<< construction / NANOS_TO_MICROS << "us\n";
+
+	std::vector<PoolBenchOrder *> orders(count);
+	for (const char *pass : {"cold", "warm"})
+	{
+		start = get_ns();
+		for (size_t i = 0; i < count; i++)
+		{
+			orders[i] = pool.allocate(i, 100.25, 10u, std::string("ACCOUNT-0123456789-ABCDEFGHIJKLM"));
+		}
+		const double allocate_ns = static_cast<double>(get_ns() - start) / count;
+
+		start = get_ns();
+		for (size_t i = 0; i < count; i++)
+		{
+			pool.deallocate(orders[i]);
+		}
+		const double deallocate_ns = static_cast<double>(get_ns() - start) / count;
+
+		std::cout << "  " << pass << " allocate: " << allocate_ns << "ns deallocate: " << deallocate_ns << "ns\n";
+	}
+}
+
+// Per trade cost of keeping every RollingWindow signal up to date, and a full window reduction with the scalar and
+// the dispatched (AVX2 where available) kernel.
+void rolling_window_bench()
+{
+	using namespace Common;
+
+	constexpr size_t trades = 1 << 23;
+	constexpr int reductions = 1000;
+
+	std::mt19937 rng(42);
+	std::normal_distribution<double> step(0, 0.01);
+	std::vector<double> prices(trades);
+	double price = 100;
+	for (double &p : prices)
+	{
+		price += step(rng);
+		p = price;
+	}
+
+	for (const size_t window : {256, 4096, 65536})
+	{
+		RollingWindow rolling(window);
+
+		nanos start = get_ns();
+		double signal = 0;
+		for (size_t i = 0; i < trades; i++)
+		{
+			rolling.add(static_cast<nanos>(i), prices[i], static_cast<double>(1 + (i & 7)));
+			signal += rolling.vwap() + rolling.variance() + rolling.ewma() + rolling.min() + rolling.max();
+		}
+		const double add_ns = static_cast<double>(get_ns() - start) / trades;
+
+		start = get_ns();
+		for (int i = 0; i < reductions; i++)
+		{
+			signal += rolling.batch(window_sums_scalar).sum_sq_;
+		}
+		const double scalar_ns = static_cast<double>(get_ns() - start) / reductions;
+
+		start = get_ns();
+		for (int i = 0; i < reductions; i++)
+		{
+			signal += rolling.batch().sum_sq_;
+		}
+		const double dispatched_ns = static_cast<double>(get_ns() - start) / reductions;
+
+		const WindowSums batch = rolling.batch();
+		ASSERT(std::abs(batch.min_ - rolling.min()) < 1e-12 && std::abs(batch.max_ - rolling.max()) < 1e-12,
+		       "RollingWindow min/max disagree with the batch kernel");
+
+		std::cout << "RollingWindow " << window << " trades, add + read signals: " << add_ns
+			<< "ns/trade, whole window scalar: " << scalar_ns << "ns dispatched: " << dispatched_ns << "ns ("
+			<< (window_sums == window_sums_scalar ? "scalar" : "avx2") << ")\n";
+		asm volatile("" : : "r"(&signal) : "memory");
+	}
+}
+
+struct BookBenchEvent
+{
+	enum Type : uint8_t
+	{
+		ADD,
+		CANCEL,
+		EXECUTE,
+		MODIFY
+	};
+
+	Type type_;
+	Common::Side side_;
+	Common::OrderId id_;
+	Common::Price price_;
+	Common::Qty qty_;
+};
+
+/// Applies one replayed event to the book.
+static void apply_book_event(Common::OrderBook &book, const BookBenchEvent &event)
+{
+	switch (event.type_)
+	{
+		case BookBenchEvent::ADD:
+			book.add(event.id_, event.side_, event.price_, event.qty_);
+			break;
+		case BookBenchEvent::CANCEL:
+			book.cancel(event.id_);
+			break;
+		case BookBenchEvent::EXECUTE:
+			book.execute(event.id_, event.qty_);
+			break;
+		case BookBenchEvent::MODIFY:
+			book.modify(event.id_, event.price_, event.qty_);
+			break;
+	}
+}
+
+// Replays millions of add/cancel/execute/modify events around ~100K resting orders: once untimed for throughput,
+// once timing every event for the distribution (which includes two clock reads per event).
+void order_book_bench()
+{
+	using namespace Common;
+
+	constexpr size_t events = 5'000'000;
+	constexpr size_t target_live = 100'000;
+	constexpr size_t max_levels = 4096;
+
+	// Generate against a book of its own so executes hit the real front of the queue and cancels live orders.
+	std::vector<BookBenchEvent> replay;
+	replay.reserve(events);
+	{
+		OrderBook book(2 * target_live, max_levels, events);
+		std::vector<OrderId> live;
+		std::mt19937_64 rng(42);
+		Price mid = 100'000;
+		OrderId next_id = 0;
+
+		while (replay.size() < events)
+		{
+			const uint64_t roll = rng() % 100;
+			const Side side = rng() & 1 ? Side::BUY : Side::SELL;
+
+			if (live.empty() || roll < (live.size() < target_live ? 55u : 45u))
+			{
+				const Price offset = static_cast<Price>(std::min<uint64_t>(rng() % 64, rng() % 256));
+				const Price price = side == Side::BUY ? mid - 1 - offset : mid + 1 + offset;
+				const Qty qty = static_cast<Qty>(1 + rng() % 100);
+				replay.push_back({BookBenchEvent::ADD, side, next_id, price, qty});
+				book.add(next_id, side, price, qty);
+				live.push_back(next_id++);
+				continue;
+			}
+
+			if (roll < 90)
+			{
+				const size_t idx = rng() % live.size();
+				const OrderId id = live[idx];
+				const BookOrder *order = book.order(id);
+
+				if (roll < 85)
+				{
+					replay.push_back({BookBenchEvent::CANCEL, order->side_, id, order->price_, 0});
+					book.cancel(id);
+					live[idx] = live.back();
+					live.pop_back();
+				}
+				else
+				{
+					const Qty qty = std::max<Qty>(1, order->qty_ / 2);
+					replay.push_back({BookBenchEvent::MODIFY, order->side_, id, order->price_, qty});
+					book.modify(id, order->price_, qty);
+				}
+				continue;
+			}
+
+			if (const PriceLevel *best = book.best_level(side))
+			{
+				const OrderId id = best->first_->id_;
+				const Qty qty = static_cast<Qty>(1 + rng() % 100);
+				replay.push_back({BookBenchEvent::EXECUTE, side, id, best->price_, qty});
+				if (qty >= best->first_->qty_)
+				{
+					live.erase(std::find(live.begin(), live.end(), id));
+				}
+				book.execute(id, qty);
+			}
+
+			// Let the market drift a tick now and then.
+			if (roll == 99)
+			{
+				mid += rng() & 1 ? 1 : -1;
+			}
+		}
+	}
+
+	{
+		OrderBook book(2 * target_live, max_levels, events);
+		const nanos start = get_ns();
+		for (const BookBenchEvent &event : replay)
+		{
+			apply_book_event(book, event);
+		}
+		const nanos elapsed = get_ns() - start;
+
+		std::cout << "OrderBook replay of " << events << " events: " << static_cast<double>(elapsed) / events
+			<< "ns/event, " << book.order_count() << " orders on " << book.level_count() << " levels at the end\n";
+	}
+
+	{
+		OrderBook book(2 * target_live, max_levels, events);
+		std::vector<nanos> latencies(events);
+		for (size_t i = 0; i < events; i++)
+		{
+			const nanos start = get_ns();
+			apply_book_event(book, replay[i]);
+			latencies[i] = get_ns() - start;
+		}
+
+		std::sort(latencies.begin(), latencies.end());
+		std::cout << "OrderBook per event (timed individually) p50: " << latencies[events / 2] << "ns p99: "
+			<< latencies[events * 99 / 100] << "ns p99.9: " << latencies[events * 999 / 1000] << "ns\n";
+	}
+}
+
+// Request to acknowledgement latency through the MatchingEngine: the gateway (this thread) stamps a request, pushes
+// it and spins until the engine's ACCEPTED/CANCELED/MODIFIED/*_REJECTED response for it comes back, one request in
+// flight at a time. With a spare core the engine runs pinned on its own thread, on a single core it is polled inline
+// from the gateway loop, which still covers both queue hops and the matching.
+// Order flow for the engine from a few clients around a fixed mid: 65% new orders, mostly passive and some priced
+// through the touch, 30% cancels and 5% modifies of recent orders.
+static std::vector<Common::ClientRequest> make_engine_requests(size_t requests, Common::ClientId clients)
+{
+	using namespace Common;
+
+	std::mt19937_64 rng(42);
+	std::vector<ClientRequest> replay(requests);
+	std::vector<OrderId> next_client_order(clients, 0);
+	const Price mid = 10'000;
+	for (ClientRequest &request : replay)
+	{
+		const uint64_t roll = rng() % 100;
+		const ClientId client = static_cast<ClientId>(rng() % clients);
+		const Side side = rng() & 1 ? Side::BUY : Side::SELL;
+		const Price direction = side == Side::BUY ? -1 : 1;
+
+		if (roll < 65 || next_client_order[client] == 0)
+		{
+			// Mostly passive, some priced through the touch.
+			const Price offset = roll < 50 ? 1 + static_cast<Price>(rng() % 20) : -static_cast<Price>(rng() % 5);
+			request = {ClientRequestType::NEW, side, client, next_client_order[client]++, mid + direction * offset,
+			           static_cast<Qty>(1 + rng() % 100)};
+		}
+		else
+		{
+			const OrderId recent = next_client_order[client] - 1 - rng() % std::min<OrderId>(next_client_order[client], 256);
+			request = {roll < 95 ? ClientRequestType::CANCEL : ClientRequestType::MODIFY, side, client, recent,
+			           mid + direction * (1 + static_cast<Price>(rng() % 20)), static_cast<Qty>(1 + rng() % 50)};
+		}
+	}
+
+	return replay;
+}
+
+void matching_engine_bench()
+{
+	using namespace Common;
+
+	constexpr size_t requests = 1'000'000;
+	constexpr ClientId clients = 8;
+	const bool threaded = std::thread::hardware_concurrency() >= 2;
+
+	ClientRequestQueue request_q(64 * 1024);
+	ClientResponseQueue response_q(256 * 1024);
+	MarketUpdateQueue update_q(256 * 1024);
+	Logger logger("matching_engine_bench.log");
+	MatchingEngine engine(&request_q, &response_q, &update_q, logger,
+	                      {.max_clients_ = clients, .max_client_orders_ = 1 << 18});
+
+	std::vector<ClientRequest> replay = make_engine_requests(requests, clients);
+
+	if (threaded)
+	{
+		engine.start(1);
+	}
+
+	std::vector<nanos> latencies;
+	latencies.reserve(requests);
+	size_t fills = 0;
+	size_t updates = 0;
+
+	for (ClientRequest &request : replay)
+	{
+		request.ts_ = get_ns();
+		*request_q.get_next_write_loc() = request;
+		request_q.update_write_idx();
+
+		for (bool acked = false; !acked;)
+		{
+			if (!threaded)
+			{
+				engine.poll();
+			}
+
+			for (const ClientResponse *response = response_q.get_next_to_read(); response;
+			     response = response_q.get_next_to_read())
+			{
+				if (response->type_ == ClientResponseType::FILLED)
+				{
+					fills++;
+				}
+				else
+				{
+					latencies.push_back(get_ns() - response->request_ts_);
+					acked = true;
+				}
+				response_q.update_read_idx();
+			}
+		}
+
+		for (const MarketUpdate *update = update_q.get_next_to_read(); update; update = update_q.get_next_to_read())
+		{
+			updates++;
+			update_q.update_read_idx();
+		}
+	}
+
+	engine.stop();
+
+	ASSERT(latencies.size() == requests, "MatchingEngine bench missed acknowledgements");
+	std::sort(latencies.begin(), latencies.end());
+	std::cout << "MatchingEngine (" << (threaded ? "pinned engine thread" : "inline, single core") << ") "
+		<< requests << " requests, " << fills << " fills, " << updates << " market updates, request to ack p50: "
+		<< latencies[requests / 2] << "ns p99: " << latencies[requests * 99 / 100] << "ns p99.9: "
+		<< latencies[requests * 999 / 1000] << "ns, " << engine.book().order_count() << " orders resting, "
+		<< logger.stats().dropped_records_ << " log records dropped\n";
+}
+
+template<typename F>
+static double time_per_op(size_t ops, F &&op)
+{
+	using namespace Common;
+
+	const nanos start = get_ns();
+	for (size_t i = 0; i < ops; i++)
+	{
+		op(i);
+	}
+	return static_cast<double>(get_ns() - start) / ops;
+}
+
+// FlatPriceMap and DirectIndex against std::unordered_map: price to level lookups (hits and misses) and level churn
+// at several occupancies of a table sized for a 4096 level pool, and order id lookups over a million live orders.
+void lookup_table_bench()
+{
+	using namespace Common;
+
+	constexpr size_t max_levels = 4096;
+	constexpr size_t ops = 1 << 22;
+	std::mt19937_64 rng(42);
+	PriceLevel level;
+	uint64_t found = 0;
+
+	for (const size_t live : {64, 512, 2048, 4096})
+	{
+		// Prices clustered around a mid with some far outliers, the way resting levels spread.
+		std::vector<Price> prices;
+		std::vector<Price> absent;
+		for (Price p = 100'000; prices.size() < live; p += 1 + static_cast<Price>(rng() % 4))
+		{
+			prices.push_back(rng() % 16 == 0 ? p * 7 : p);
+			absent.push_back(-p);
+		}
+
+		FlatPriceMap<PriceLevel *> flat(max_levels);
+		std::unordered_map<Price, PriceLevel *> map;
+		map.reserve(max_levels);
+		for (const Price p : prices)
+		{
+			flat.insert(p, &level);
+			map.emplace(p, &level);
+		}
+
+		std::vector<uint32_t> order(ops);
+		for (uint32_t &i : order)
+		{
+			i = static_cast<uint32_t>(rng() % live);
+		}
+
+		const double flat_hit = time_per_op(ops, [&](size_t i) { found += flat.find(prices[order[i]]) != nullptr; });
+		const double map_hit = time_per_op(ops, [&](size_t i) { found += map.find(prices[order[i]]) != map.end(); });
+		const double flat_miss = time_per_op(ops, [&](size_t i) { found += flat.find(absent[order[i]]) != nullptr; });
+		const double map_miss = time_per_op(ops, [&](size_t i) { found += map.find(absent[order[i]]) != map.end(); });
+		const double flat_churn = time_per_op(ops, [&](size_t i)
+		{
+			flat.erase(prices[order[i]]);
+			flat.insert(prices[order[i]], &level);
+		});
+		const double map_churn = time_per_op(ops, [&](size_t i)
+		{
+			map.erase(prices[order[i]]);
+			map.emplace(prices[order[i]], &level);
+		});
+
+		std::cout << "Price to level, " << live << "/" << max_levels << " levels: hit FlatPriceMap " << flat_hit
+			<< "ns unordered_map " << map_hit << "ns, miss " << flat_miss << "ns / " << map_miss
+			<< "ns, erase+insert " << flat_churn << "ns / " << map_churn << "ns\n";
+	}
+
+	{
+		constexpr size_t orders = 1'000'000;
+		std::vector<BookOrder> book_orders(orders);
+		DirectIndex<BookOrder *> direct(orders, nullptr);
+		std::unordered_map<OrderId, BookOrder *> map;
+		map.reserve(orders);
+		for (size_t i = 0; i < orders; i++)
+		{
+			direct[i] = &book_orders[i];
+			map.emplace(i, &book_orders[i]);
+		}
+
+		std::vector<OrderId> ids(ops);
+		for (OrderId &id : ids)
+		{
+			id = rng() % orders;
+		}
+
+		const double direct_ns = time_per_op(ops, [&](size_t i) { found += direct.find(ids[i])->qty_; });
+		const double map_ns = time_per_op(ops, [&](size_t i) { found += map.find(ids[i])->second->qty_; });
+		std::cout << "Order id to order, " << orders << " live: DirectIndex " << direct_ns << "ns unordered_map "
+			<< map_ns << "ns\n";
+	}
+
+	asm volatile("" : : "r"(&found) : "memory");
+}
+
+// A FeedHandler on loopback multicast: packets per second through recvmmsg() while a sender bursts, then the latency
+// of one packet at a time from the sender's stamp to the handler's receive and to the update leaving the queue.
+void feed_handler_bench()
+{
+	using namespace Common;
+
+	const std::string group = "239.255.0.1";
+	const std::string iface = "lo";
+	constexpr int port = 40001;
+	constexpr size_t burst_packets = 500'000;
+	constexpr size_t burst = 32;
+	constexpr size_t ping_packets = 50'000;
+	constexpr uint32_t updates_per_packet = 8;
+	const bool threaded = std::thread::hardware_concurrency() >= 2;
+
+	Logger logger("feed_handler_bench.log");
+	MDUpdateQueue queue(1 << 20);
+	FeedHandler handler(&queue, logger, group, iface, port);
+	const int sender = create_socket(logger, group, iface, port, true, false, false, 1, false);
+	ASSERT(sender != -1, "feed_handler_bench could not open the sending socket");
+
+	uint8_t packet[MD_MAX_PACKET];
+	const size_t packet_len = sizeof(MDPacketHeader) + updates_per_packet * sizeof(MarketUpdate);
+	for (uint32_t i = 0; i < updates_per_packet; i++)
+	{
+		const MarketUpdate update {MarketUpdateType::ADD, Side::BUY, i, 10'000 + i, 100};
+		std::memcpy(packet + sizeof(MDPacketHeader) + i * sizeof(MarketUpdate), &update, sizeof(update));
+	}
+
+	uint64_t seq = 0;
+	auto send_packet = [&]()
+	{
+		const MDPacketHeader header {++seq, get_ns(), 0, updates_per_packet};
+		std::memcpy(packet, &header, sizeof(header));
+		while (send(sender, packet, packet_len, 0) == -1 && would_block())
+		{
+		}
+	};
+
+	size_t consumed = 0;
+	size_t gaps_seen = 0;
+	auto drain = [&]()
+	{
+		const LFQSpans<const MDUpdate> ready = queue.get_all_to_read();
+		for (size_t i = 0; i < ready.size(); i++)
+		{
+			gaps_seen += ready[i].gap_before_;
+		}
+		queue.update_read_idx(ready.size());
+		consumed += ready.size();
+		return ready.size();
+	};
+
+	if (threaded)
+	{
+		handler.start(1);
+	}
+
+	const nanos start = get_ns();
+	for (size_t sent = 0; sent < burst_packets; sent += burst)
+	{
+		for (size_t i = 0; i < burst; i++)
+		{
+			send_packet();
+		}
+		if (!threaded)
+		{
+			while (handler.poll() != 0)
+			{
+			}
+		}
+		drain();
+	}
+	// Whatever the kernel dropped never arrives, stop once nothing has come in for a while.
+	for (nanos idle_since = get_ns(); get_ns() - idle_since < 50 * NANOS_TO_MILIS;)
+	{
+		if (!threaded)
+		{
+			handler.poll();
+		}
+		if (drain() != 0)
+		{
+			idle_since = get_ns();
+		}
+	}
+	const double seconds = static_cast<double>(get_ns() - start) / NANOS_TO_SECS;
+	const size_t burst_updates = consumed;
+
+	// Stats are only consistent with the handler thread stopped.
+	handler.stop();
+	const FeedStats stats = handler.stats();
+	if (threaded)
+	{
+		handler.start(1);
+	}
+
+	// Where a packet's time goes: sender to the kernel's receive timestamp, kernel to recvmmsg() returning it, and
+	// from there to the consumer taking its updates off the queue.
+	std::vector<nanos> to_kernel;
+	std::vector<nanos> to_read;
+	std::vector<nanos> to_consumer;
+	to_kernel.reserve(ping_packets);
+	to_read.reserve(ping_packets);
+	to_consumer.reserve(ping_packets);
+	for (size_t i = 0; i < ping_packets; i++)
+	{
+		send_packet();
+		for (size_t received = 0; received < updates_per_packet;)
+		{
+			if (!threaded)
+			{
+				handler.poll();
+			}
+
+			const LFQSpans<const MDUpdate> ready = queue.get_all_to_read();
+			if (received == 0 && !ready.empty())
+			{
+				const MDUpdate &first = ready[0];
+				to_consumer.push_back(get_ns() - first.read_ts_);
+				to_read.push_back(first.read_ts_ - first.recv_ts_);
+				to_kernel.push_back(first.recv_ts_ - first.send_ts_);
+			}
+			received += ready.size();
+			queue.update_read_idx(ready.size());
+		}
+	}
+
+	handler.stop();
+	close(sender);
+
+	auto percentiles = [](std::vector<nanos> &latencies)
+	{
+		std::sort(latencies.begin(), latencies.end());
+		return std::to_string(latencies[latencies.size() / 2]) + "/" +
+			std::to_string(latencies[latencies.size() * 99 / 100]) + "ns";
+	};
+	std::cout << "FeedHandler (" << (threaded ? "pinned handler thread" : "inline, single core") << ") burst: "
+		<< burst_updates / updates_per_packet << "/" << burst_packets << " packets in " << seconds << "s, "
+		<< static_cast<double>(burst_updates / updates_per_packet) / seconds << " packets/s "
+		<< static_cast<double>(burst_updates) / seconds << " updates/s, "
+		<< static_cast<double>(stats.packets_) / stats.recv_calls_ << " packets per recvmmsg(), gaps: " << stats.gaps_
+		<< " (" << gaps_seen << " flagged) missed: " << stats.missed_packets_ << " stale: " << stats.stale_packets_
+		<< " bad: " << stats.bad_packets_ << "\n";
+	std::cout << "FeedHandler one packet in flight p50/p99, send to kernel receive: " << percentiles(to_kernel)
+		<< ", kernel to recvmmsg() return: " << percentiles(to_read) << ", recvmmsg() to consumer: "
+		<< percentiles(to_consumer) << "\n";
+}
+
+// The engine's market updates through a MarketDataPublisher on loopback multicast: publishing cost per update, how
+// many updates share a packet and a sendmmsg(), the cost of a snapshot, and a subscriber joining halfway through that
+// rebuilds the book from the next snapshot and the incremental packets after it.
+void md_publisher_bench()
+{
+	using namespace Common;
+
+	constexpr size_t requests = 1'000'000;
+	constexpr ClientId clients = 8;
+	constexpr size_t burst = 64; // updates the engine hands over between two polls
+	const std::string iface = "lo";
+	const std::string incremental_ip = "239.255.0.11";
+	const std::string snapshot_ip = "239.255.0.12";
+	constexpr int incremental_port = 40011;
+	constexpr int snapshot_port = 40012;
+	const MDPublisherConfig config {.snapshot_interval_ = 20 * NANOS_TO_MILIS};
+	const MatchingEngineConfig engine_config {.max_clients_ = clients, .max_client_orders_ = 1 << 18};
+
+	// The updates the engine publishes for the usual order flow, recorded once.
+	std::vector<MarketUpdate> feed;
+	{
+		ClientRequestQueue request_q(64 * 1024);
+		ClientResponseQueue response_q(256 * 1024);
+		MarketUpdateQueue update_q(256 * 1024);
+		Logger engine_logger("md_publisher_bench_engine.log");
+		MatchingEngine engine(&request_q, &response_q, &update_q, engine_logger, engine_config);
+
+		for (const ClientRequest &request : make_engine_requests(requests, clients))
+		{
+			*request_q.get_next_write_loc() = request;
+			request_q.update_write_idx();
+			engine.poll();
+
+			response_q.update_read_idx(response_q.get_all_to_read().size());
+			const LFQSpans<const MarketUpdate> updates = update_q.get_all_to_read();
+			for (size_t i = 0; i < updates.size(); i++)
+			{
+				feed.push_back(updates[i]);
+			}
+			update_q.update_read_idx(updates.size());
+		}
+	}
+
+	Logger logger("md_publisher_bench.log");
+	MarketUpdateQueue update_q(256 * 1024);
+	MarketDataPublisher publisher(&update_q, engine_config, logger, iface, incremental_ip, incremental_port,
+	                              snapshot_ip, snapshot_port, config);
+
+	std::unique_ptr<MDUpdateQueue> incremental_q;
+	std::unique_ptr<MDUpdateQueue> snapshot_q;
+	std::unique_ptr<FeedHandler> incremental_feed;
+	std::unique_ptr<FeedHandler> snapshot_feed;
+	std::optional<OrderBook> joiner;
+	uint64_t synced_seq = 0;
+	bool synced = false;
+
+	nanos publishing = 0;
+	nanos snapshotting = 0;
+	for (size_t done = 0; done < feed.size(); done += burst)
+	{
+		if (!incremental_feed && done >= feed.size() / 2)
+		{
+			incremental_q = std::make_unique<MDUpdateQueue>(1 << 20);
+			snapshot_q = std::make_unique<MDUpdateQueue>(1 << 20);
+			incremental_feed = std::make_unique<FeedHandler>(incremental_q.get(), logger, incremental_ip, iface,
+			                                                 incremental_port);
+			snapshot_feed = std::make_unique<FeedHandler>(snapshot_q.get(), logger, snapshot_ip, iface, snapshot_port);
+		}
+
+		const size_t n = std::min(burst, feed.size() - done);
+		for (size_t i = 0; i < n; i++)
+		{
+			*update_q.get_next_write_loc() = feed[done + i];
+			update_q.update_write_idx();
+		}
+
+		const uint64_t snapshots = publisher.stats().snapshots_;
+		const nanos start = get_ns();
+		publisher.poll();
+		(publisher.stats().snapshots_ == snapshots ? publishing : snapshotting) += get_ns() - start;
+
+		if (!incremental_feed)
+		{
+			continue;
+		}
+
+		// Snapshots first, the incremental packets after the one a snapshot ends at are sent after it.
+		while (snapshot_feed->poll() != 0)
+		{
+		}
+		const LFQSpans<const MDUpdate> snapshot = snapshot_q->get_all_to_read();
+		for (size_t i = 0; i < snapshot.size() && !synced; i++)
+		{
+			const MarketUpdate &update = snapshot[i].update_;
+			if (snapshot[i].gap_before_)
+			{
+				// Part of this snapshot was lost, wait for the next one.
+				joiner.reset();
+			}
+			if (update.type_ == MarketUpdateType::SNAPSHOT_START)
+			{
+				joiner.emplace(engine_config.max_orders_, engine_config.max_levels_, engine_config.max_orders_);
+			}
+			else if (update.type_ == MarketUpdateType::SNAPSHOT_END && joiner)
+			{
+				synced = true;
+				synced_seq = update.order_id_;
+			}
+			else if (joiner)
+			{
+				apply_update(*joiner, update);
+			}
+		}
+		snapshot_q->update_read_idx(snapshot.size());
+
+		while (incremental_feed->poll() != 0)
+		{
+		}
+		const LFQSpans<const MDUpdate> incremental = incremental_q->get_all_to_read();
+		for (size_t i = 0; i < incremental.size(); i++)
+		{
+			if (synced && incremental[i].seq_ > synced_seq)
+			{
+				apply_update(*joiner, incremental[i].update_);
+			}
+		}
+		incremental_q->update_read_idx(incremental.size());
+	}
+
+	const OrderBook &book = publisher.book();
+	bool in_sync = synced && joiner->order_count() == book.order_count() && joiner->level_count() == book.level_count();
+	for (const Side side : {Side::BUY, Side::SELL})
+	{
+		for (const PriceLevel *level = book.best_level(side); level && in_sync; level = level->worse_)
+		{
+			for (const BookOrder *order = level->first_; order && in_sync; order = order->next_)
+			{
+				const BookOrder *copy = joiner->order(order->id_);
+				in_sync = copy && copy->side_ == side && copy->price_ == order->price_ && copy->qty_ == order->qty_;
+			}
+		}
+	}
+
+	const MDPublisherStats &stats = publisher.stats();
+	const uint64_t packets = publisher.incremental().seq();
+	std::cout << "MarketDataPublisher " << stats.updates_ << " updates in bursts of " << burst << ": "
+		<< static_cast<double>(publishing) / stats.updates_ << "ns per update, " << packets << " packets ("
+		<< static_cast<double>(stats.updates_) / packets << " updates each) in "
+		<< publisher.incremental().send_calls() << " sendmmsg() calls, " << publisher.incremental().dropped_packets()
+		<< " dropped, " << stats.refused_updates_ << " refused by its book\n";
+	std::cout << "MarketDataPublisher " << stats.snapshots_ << " snapshots, " << stats.snapshot_updates_ << " updates in "
+		<< publisher.snapshot().seq() << " packets, " << snapshotting / stats.snapshots_ / NANOS_TO_MICROS
+		<< "us each, the last of " << book.order_count() << " orders on " << book.level_count() << " levels\n";
+	std::cout << "MarketDataPublisher late joiner " << (in_sync ? "in sync" : "OUT OF SYNC") << " from incremental seq "
+		<< synced_seq << ", gaps incremental: " << incremental_feed->stats().gaps_ << " snapshot: "
+		<< snapshot_feed->stats().gaps_ << "\n";
+}
+
+// Thousands of loopback TCP sessions against a TCPServer that echoes every frame: connection setup, round trips per
+// second with every client sending a frame per round, and the round trip of a single frame in flight.
+void tcp_server_bench()
+{
+	using namespace Common;
+
+	constexpr size_t clients = 4000;
+	constexpr size_t rounds = 200;
+	constexpr size_t pings = 50'000;
+	constexpr int port = 40031;
+	const bool threaded = std::thread::hardware_concurrency() >= 2;
+
+	struct Frame
+	{
+		nanos send_ts_;
+		uint8_t payload_[56];
+	};
+
+	Logger logger("tcp_server_bench.log");
+
+	TCPServer *server_ptr = nullptr;
+	TCPServer server(logger, {.on_frame_ = [&server_ptr](TCPSession &session, const uint8_t *data, size_t len, nanos)
+	{
+		server_ptr->send_frame(session, data, len);
+	}, .on_connect_ = {}, .on_disconnect_ = {}}, {.max_sessions_ = clients});
+	server_ptr = &server;
+
+	std::vector<nanos> latencies;
+	std::vector<nanos> from_kernel; // the echo's kernel receive timestamp to its callback
+	latencies.reserve(clients * rounds);
+	from_kernel.reserve(clients * rounds);
+	size_t responses = 0;
+	TCPServer client_side(logger, {.on_frame_ = [&](TCPSession &, const uint8_t *data, size_t, nanos rx_ts)
+	{
+		Frame frame;
+		std::memcpy(&frame, data, sizeof(frame));
+		const nanos now = get_ns();
+		latencies.push_back(now - frame.send_ts_);
+		from_kernel.push_back(now - rx_ts);
+		responses++;
+	}, .on_connect_ = {}, .on_disconnect_ = {}}, {.max_sessions_ = clients});
+
+	ASSERT(server.listen("lo", port), "tcp_server_bench could not listen");
+
+	const nanos connect_start = get_ns();
+	std::vector<TCPSession *> sessions;
+	for (size_t i = 0; i < clients; i++)
+	{
+		sessions.push_back(client_side.connect("127.0.0.1", port));
+		ASSERT(sessions.back() != nullptr, "tcp_server_bench could not connect");
+		if (i % 64 == 0)
+		{
+			server.poll();
+		}
+	}
+	while (server.session_count() < clients)
+	{
+		server.poll();
+		client_side.poll();
+	}
+	const nanos connect_ns = get_ns() - connect_start;
+
+	if (threaded)
+	{
+		server.start(1);
+	}
+
+	auto exchange = [&](size_t expected)
+	{
+		while (responses < expected)
+		{
+			if (!threaded)
+			{
+				server.poll();
+			}
+			client_side.poll();
+		}
+	};
+
+	Frame frame {};
+	const nanos start = get_ns();
+	for (size_t round = 0; round < rounds; round++)
+	{
+		for (TCPSession *session : sessions)
+		{
+			frame.send_ts_ = get_ns();
+			client_side.send_frame(*session, &frame, sizeof(frame));
+		}
+		client_side.poll();
+		exchange((round + 1) * clients);
+	}
+	const double seconds = static_cast<double>(get_ns() - start) / NANOS_TO_SECS;
+
+	std::sort(latencies.begin(), latencies.end());
+	const nanos loaded_p50 = latencies[latencies.size() / 2];
+	const nanos loaded_p99 = latencies[latencies.size() * 99 / 100];
+	latencies.clear();
+	from_kernel.clear();
+
+	std::mt19937_64 rng(42);
+	for (size_t i = 0; i < pings; i++)
+	{
+		frame.send_ts_ = get_ns();
+		client_side.send_frame(*sessions[rng() % clients], &frame, sizeof(frame));
+		client_side.poll();
+		exchange(rounds * clients + i + 1);
+	}
+
+	server.stop();
+	std::sort(latencies.begin(), latencies.end());
+	std::sort(from_kernel.begin(), from_kernel.end());
+
+	const TCPServerStats &stats = server.stats();
+	std::cout << "TCPServer (" << (threaded ? "pinned server thread" : "inline, single core") << ") " << clients
+		<< " sessions connected in " << connect_ns / NANOS_TO_MILIS << "ms, " << clients * rounds << " echoes in "
+		<< seconds << "s: " << static_cast<double>(clients * rounds) / seconds << " round trips/s, p50: "
+		<< loaded_p50 << "ns p99: " << loaded_p99 << "ns with every session busy\n";
+	std::cout << "TCPServer one frame in flight p50: " << latencies[pings / 2] << "ns p99: "
+		<< latencies[pings * 99 / 100] << "ns, of which kernel receive to callback p50: " << from_kernel[pings / 2]
+		<< "ns p99: " << from_kernel[pings * 99 / 100] << "ns, frames in: " << stats.frames_in_ << " per recv(): "
+		<< static_cast<double>(stats.frames_in_) / stats.recv_calls_ << ", send overflows: "
+		<< stats.send_overflows_ + client_side.stats().send_overflows_ << "\n";
+}
+
+// epoll against io_uring on loopback for the three places that can use either: TCP echo sessions, a multicast feed
+// and the log sink. Every io_uring run is repeated with SQPOLL, which only pays off with a core to spare for the
+// kernel's polling thread. Alongside the timings, the io_uring_enter() calls each run needed.
+void io_uring_bench()
+{
+	using namespace Common;
+
+	const bool threaded = std::thread::hardware_concurrency() >= 2;
+	if (!io_uring_available())
+	{
+		std::cout << "io_uring_bench: io_uring is not available here, nothing to compare\n";
+		return;
+	}
+
+	struct Variant
+	{
+		const char *name_;
+		IoBackend backend_;
+		bool sqpoll_;
+	};
+	const Variant variants[] = {{"epoll", IoBackend::EPOLL, false}, {"io_uring", IoBackend::IO_URING, false},
+	                            {"io_uring sqpoll", IoBackend::IO_URING, true}};
+
+	auto percentiles = [](std::vector<nanos> &latencies)
+	{
+		std::sort(latencies.begin(), latencies.end());
+		return std::to_string(latencies[latencies.size() / 2]) + "/" +
+			std::to_string(latencies[latencies.size() * 99 / 100]) + "ns";
+	};
+
+	Logger logger("io_uring_bench.log");
+
+	// TCP: every session echoes a 64 byte frame per round, then single frames one at a time on random sessions.
+	{
+		constexpr size_t clients = 1000;
+		constexpr size_t rounds = 100;
+		constexpr size_t pings = 20'000;
+		int port = 40041;
+
+		for (const Variant &variant : variants)
+		{
+			TCPServerConfig config {.max_sessions_ = clients, .backend_ = variant.backend_};
+			config.uring_.sqpoll_ = variant.sqpoll_;
+
+			TCPServer *server_ptr = nullptr;
+			TCPServer server(logger, {.on_frame_ = [&server_ptr](TCPSession &session, const uint8_t *data, size_t len,
+			                                                       nanos)
+			{
+				server_ptr->send_frame(session, data, len);
+			}, .on_connect_ = {}, .on_disconnect_ = {}}, config);
+			server_ptr = &server;
+
+			std::vector<nanos> latencies;
+			latencies.reserve(clients * rounds);
+			size_t responses = 0;
+			TCPServer client_side(logger, {.on_frame_ = [&](TCPSession &, const uint8_t *data, size_t, nanos)
+			{
+				nanos send_ts;
+				std::memcpy(&send_ts, data, sizeof(send_ts));
+				latencies.push_back(get_ns() - send_ts);
+				responses++;
+			}, .on_connect_ = {}, .on_disconnect_ = {}}, config);
+
+			ASSERT(server.listen("lo", port), "io_uring_bench could not listen");
+			std::vector<TCPSession *> sessions;
+			for (size_t i = 0; i < clients; i++)
+			{
+				sessions.push_back(client_side.connect("127.0.0.1", port));
+				ASSERT(sessions.back() != nullptr, "io_uring_bench could not connect");
+				server.poll();
+			}
+			while (server.session_count() < clients)
+			{
+				server.poll();
+				client_side.poll();
+			}
+			port++;
+
+			if (threaded)
+			{
+				server.start(1);
+			}
+			auto exchange = [&](size_t expected)
+			{
+				while (responses < expected)
+				{
+					if (!threaded)
+					{
+						server.poll();
+					}
+					client_side.poll();
+				}
+			};
+
+			uint8_t frame[64] = {};
+			const uint64_t enters_before = server.stats().ring_enters_ + client_side.stats().ring_enters_;
+			const nanos start = get_ns();
+			for (size_t round = 0; round < rounds; round++)
+			{
+				for (TCPSession *session : sessions)
+				{
+					const nanos now = get_ns();
+					std::memcpy(frame, &now, sizeof(now));
+					client_side.send_frame(*session, frame, sizeof(frame));
+				}
+				client_side.poll();
+				exchange((round + 1) * clients);
+			}
+			const double seconds = static_cast<double>(get_ns() - start) / NANOS_TO_SECS;
+			const std::string loaded = percentiles(latencies);
+			latencies.clear();
+
+			std::mt19937_64 rng(42);
+			for (size_t i = 0; i < pings; i++)
+			{
+				const nanos now = get_ns();
+				std::memcpy(frame, &now, sizeof(now));
+				client_side.send_frame(*sessions[rng() % clients], frame, sizeof(frame));
+				client_side.poll();
+				exchange(rounds * clients + i + 1);
+			}
+			server.stop();
+			const uint64_t enters = server.stats().ring_enters_ + client_side.stats().ring_enters_ - enters_before;
+
+			std::cout << "TCP echo " << variant.name_ << (server.backend() == variant.backend_ ? "" : " (fell back)")
+				<< ": " << static_cast<double>(clients * rounds) / seconds << " round trips/s p50/p99 " << loaded
+				<< " with " << clients << " sessions busy, one in flight p50/p99 " << percentiles(latencies)
+				<< ", io_uring_enter() per round trip: "
+				<< static_cast<double>(enters) / static_cast<double>(clients * rounds + pings) << "\n";
+		}
+	}
+
+	// Feed: bursts of 32 packets, then one packet in flight at a time, publisher send time to the consumer.
+	{
+		const std::string group = "239.255.0.21";
+		constexpr size_t burst_packets = 200'000;
+		constexpr size_t burst = 32;
+		constexpr size_t ping_packets = 20'000;
+		constexpr uint32_t updates_per_packet = 8;
+		int port = 40051;
+
+		for (const Variant &variant : variants)
+		{
+			FeedHandlerConfig config {.backend_ = variant.backend_};
+			config.uring_.sqpoll_ = variant.sqpoll_;
+
+			MDUpdateQueue queue(1 << 20);
+			FeedHandler handler(&queue, logger, group, "lo", port, config);
+			const int sender = create_socket(logger, group, "lo", port, true, false, false, 1, false);
+			ASSERT(sender != -1, "io_uring_bench could not open the sending socket");
+			port++;
+
+			uint8_t packet[sizeof(MDPacketHeader) + updates_per_packet * sizeof(MarketUpdate)] = {};
+			uint64_t seq = 0;
+			auto send_packet = [&]()
+			{
+				const MDPacketHeader header {++seq, get_ns(), 0, updates_per_packet};
+				std::memcpy(packet, &header, sizeof(header));
+				while (send(sender, packet, sizeof(packet), 0) == -1 && would_block())
+				{
+				}
+			};
+			size_t consumed = 0;
+			auto drain = [&]()
+			{
+				const LFQSpans<const MDUpdate> ready = queue.get_all_to_read();
+				queue.update_read_idx(ready.size());
+				consumed += ready.size();
+				return ready.size();
+			};
+
+			if (threaded)
+			{
+				handler.start(1);
+			}
+			const nanos start = get_ns();
+			for (size_t sent = 0; sent < burst_packets; sent += burst)
+			{
+				for (size_t i = 0; i < burst; i++)
+				{
+					send_packet();
+				}
+				if (!threaded)
+				{
+					while (handler.poll() != 0)
+					{
+					}
+				}
+				drain();
+			}
+			for (nanos idle_since = get_ns(); get_ns() - idle_since < 50 * NANOS_TO_MILIS;)
+			{
+				if (!threaded)
+				{
+					handler.poll();
+				}
+				if (drain() != 0)
+				{
+					idle_since = get_ns();
+				}
+			}
+			const double seconds = static_cast<double>(get_ns() - start) / NANOS_TO_SECS;
+			const size_t burst_packets_received = consumed / updates_per_packet;
+
+			std::vector<nanos> latencies;
+			latencies.reserve(ping_packets);
+			for (size_t i = 0; i < ping_packets; i++)
+			{
+				send_packet();
+				for (size_t received = 0; received < updates_per_packet;)
+				{
+					if (!threaded)
+					{
+						handler.poll();
+					}
+					const LFQSpans<const MDUpdate> ready = queue.get_all_to_read();
+					if (received == 0 && !ready.empty())
+					{
+						latencies.push_back(get_ns() - ready[0].send_ts_);
+					}
+					received += ready.size();
+					queue.update_read_idx(ready.size());
+				}
+			}
+			handler.stop();
+			close(sender);
+
+			const FeedStats &stats = handler.stats();
+			std::cout << "Feed " << variant.name_ << (handler.backend() == variant.backend_ ? "" : " (fell back)")
+				<< ": " << burst_packets_received << "/" << burst_packets << " packets at "
+				<< static_cast<double>(burst_packets_received) / seconds
+				<< " packets/s, one in flight send to consumer p50/p99 " << percentiles(latencies) << ", io_uring_enter() per packet: "
+				<< static_cast<double>(stats.ring_enters_) / static_cast<double>(stats.packets_) << "\n";
+		}
+	}
+
+	// Log sink: 200 byte records into the sink with a flush every 64 records, as a busy logger thread would, then
+	// the destructor waiting for the file to be complete. The flush time is what the logger thread stalls for.
+	{
+		constexpr size_t records = 1'000'000;
+		constexpr size_t records_per_flush = 64;
+		char record[200];
+		std::memset(record, 'x', sizeof(record));
+		record[sizeof(record) - 1] = '\n';
+
+		auto run = [&](const char *name, LogSink &sink, auto &&finish)
+		{
+			std::ostream out(&sink);
+			std::vector<nanos> flushes;
+			flushes.reserve(records / records_per_flush);
+
+			const nanos start = get_ns();
+			for (size_t i = 0; i < records; i++)
+			{
+				out.write(record, sizeof(record));
+				if ((i + 1) % records_per_flush == 0)
+				{
+					const nanos flush_start = get_ns();
+					out.flush();
+					flushes.push_back(get_ns() - flush_start);
+				}
+			}
+			const nanos written = get_ns() - start;
+			const nanos finish_ns = finish();
+
+			std::cout << "Log sink " << name << ": " << static_cast<double>(records * sizeof(record)) / written * 1000
+				<< " MB/s on the logger thread, flush p50/p99 " << percentiles(flushes) << ", " << finish_ns / 1000
+				<< "us to complete the file\n";
+		};
+
+		{
+			auto sink = std::make_unique<LogFileSink>("io_uring_bench_file.log");
+			run("writev()", *sink, [&]()
+			{
+				const nanos start = get_ns();
+				sink.reset();
+				return get_ns() - start;
+			});
+		}
+		for (const bool sqpoll : {false, true})
+		{
+			auto sink = std::make_unique<LogUringSink>("io_uring_bench_uring.log",
+			                                           IoUringConfig {.entries_ = 16, .sqpoll_ = sqpoll});
+			if (!sink->valid())
+			{
+				std::cout << "Log sink io_uring: could not register the buffers or the file\n";
+				break;
+			}
+			const bool has_sqpoll = sink->sqpoll();
+			run(has_sqpoll ? "io_uring sqpoll" : sqpoll ? "io_uring (sqpoll refused)" : "io_uring", *sink, [&]()
+			{
+				const nanos start = get_ns();
+				sink.reset();
+				return get_ns() - start;
+			});
+		}
+	}
+}
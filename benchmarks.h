@@ -0,0 +1,22 @@
+#ifndef LOWLATENCYFINTECH_BENCHMARKS_H
+#define LOWLATENCYFINTECH_BENCHMARKS_H
+
+void logger_startup_bench();
+void lfq_pop_bench();
+void lfq_batch_bench();
+void mpmc_bench();
+void broadcast_ring_bench();
+void mempool_bench();
+void arena_bench();
+void concurrent_pool_bench();
+void mempool_construct_bench();
+void rolling_window_bench();
+void order_book_bench();
+void matching_engine_bench();
+void lookup_table_bench();
+void feed_handler_bench();
+void md_publisher_bench();
+void tcp_server_bench();
+void io_uring_bench();
+
+#endif //LOWLATENCYFINTECH_BENCHMARKS_H
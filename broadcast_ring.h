@@ -0,0 +1,214 @@
+#ifndef LOWLATENCYFINTECH_BROADCAST_RING_H
+#define LOWLATENCYFINTECH_BROADCAST_RING_H
+
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <initializer_list>
+
+#include "macros.h"
+#include "mem_utils.h"
+#include "thread_utils.h"
+#include "lock_free_q.h"
+
+/* One producer, many consumers ring where every consumer sees every element (Disruptor style multicast).
+ *
+ * The producer publishes each element once into the same power of two store LFQueue uses. Every consumer owns a
+ * cursor (how many elements it is done with) on its own cache line and may depend on other consumers, e.g. the
+ * recorder only reads what risk has already processed. A consumer can read up to the minimum of the producer's
+ * published count and the cursors it depends on, the producer can overwrite a slot once the slowest consumer has
+ * released it. Both sides keep a cached copy of that limit and only re-read the other cursors when it runs out.
+ *
+ * Consumers are added before the producer starts:
+ *
+ *     BroadcastRing<Update> ring(4096);
+ *     auto &strategy = ring.add_consumer();
+ *     auto &risk = ring.add_consumer();
+ *     auto &recorder = ring.add_consumer({&risk});
+ */
+template<typename T>
+class BroadcastRing final
+{
+public:
+	class Consumer final
+	{
+	private:
+		friend class BroadcastRing;
+
+		const BroadcastRing &ring_;
+		std::vector<const std::atomic<size_t> *> depends_on_;
+
+		alignas(Common::CACHE_LINE_SIZE) std::atomic<size_t> cursor_ = {0};
+		size_t cached_limit_ = 0;
+
+		char padding_[Common::CACHE_LINE_SIZE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+
+		size_t refresh_limit() noexcept
+		{
+			size_t limit = ring_.published_.load(std::memory_order_acquire);
+			for (const std::atomic<size_t> *cursor : depends_on_)
+			{
+				limit = std::min(limit, cursor->load(std::memory_order_acquire));
+			}
+
+			cached_limit_ = limit;
+			return limit;
+		}
+
+	public:
+		Consumer(const BroadcastRing &ring, std::initializer_list<const Consumer *> depends_on) : ring_(ring)
+		{
+			for (const Consumer *consumer : depends_on)
+			{
+				ASSERT(&consumer->ring_ == &ring_, "Consumer depends on a consumer of another ring");
+				depends_on_.push_back(&consumer->cursor_);
+			}
+		}
+
+		Consumer() = delete;
+		Consumer(const Consumer&) = delete;
+		Consumer(const Consumer&&) = delete;
+		Consumer& operator=(const Consumer&) = delete;
+		Consumer& operator=(const Consumer&&) = delete;
+
+		const T* get_next_to_read() noexcept
+		{
+			const size_t cursor = cursor_.load(std::memory_order_relaxed);
+
+			if (cursor == cached_limit_ && cursor == refresh_limit())
+			{
+				return nullptr;
+			}
+
+			return &ring_.store_[cursor & ring_.mask_];
+		}
+
+		/// Everything this consumer may read right now, as one batch.
+		LFQSpans<const T> get_all_to_read() noexcept
+		{
+			const size_t cursor = cursor_.load(std::memory_order_relaxed);
+			const size_t limit = refresh_limit();
+			const size_t begin = cursor & ring_.mask_;
+			const size_t first = std::min(limit - cursor, ring_.capacity_ - begin);
+
+			return {std::span<const T>(ring_.store_ + begin, first),
+			        std::span<const T>(ring_.store_, limit - cursor - first)};
+		}
+
+		/// Marks the next n elements done, releasing them to dependent consumers and, once every consumer is past
+		/// them, to the producer.
+		void update_read_idx(size_t n = 1) noexcept
+		{
+			cursor_.store(cursor_.load(std::memory_order_relaxed) + n, std::memory_order_release);
+		}
+
+		size_t cursor() const noexcept
+		{
+			return cursor_.load(std::memory_order_acquire);
+		}
+	};
+
+private:
+	const size_t capacity_;
+	const size_t mask_;
+
+	// Every consumer reads the same slots, so huge pages and prefaulting from the ArenaConfig pay off once for all.
+	Common::Arena arena_;
+	T *store_ = nullptr;
+	std::vector<std::unique_ptr<Consumer>> consumers_;
+
+	// Producer cache line.
+	alignas(Common::CACHE_LINE_SIZE) std::atomic<size_t> published_ = {0};
+	size_t cached_gate_ = 0;
+
+	char padding_[Common::CACHE_LINE_SIZE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+
+	/// The slowest consumer's cursor, the producer can not get a full lap ahead of it.
+	size_t refresh_gate() noexcept
+	{
+		size_t gate = published_.load(std::memory_order_relaxed);
+		for (const std::unique_ptr<Consumer> &consumer : consumers_)
+		{
+			gate = std::min(gate, consumer->cursor_.load(std::memory_order_acquire));
+		}
+
+		cached_gate_ = gate;
+		return gate;
+	}
+
+public:
+	explicit BroadcastRing(size_t num_elems, const Common::ArenaConfig &arena = {}) :
+		capacity_(std::bit_ceil(num_elems)), mask_(capacity_ - 1), arena_(capacity_ * sizeof(T), arena),
+		store_(static_cast<T *>(arena_.data()))
+	{
+		if constexpr (!Common::is_lazily_committable<T>)
+		{
+			for (size_t i = 0; i < capacity_; i++)
+			{
+				new(&store_[i]) T();
+			}
+		}
+	}
+
+	~BroadcastRing()
+	{
+		if constexpr (!Common::is_lazily_committable<T>)
+		{
+			for (size_t i = 0; i < capacity_; i++)
+			{
+				store_[i].~T();
+			}
+		}
+	}
+
+	BroadcastRing() = delete;
+	BroadcastRing(const BroadcastRing&) = delete;
+	BroadcastRing(const BroadcastRing&&) = delete;
+	BroadcastRing& operator=(const BroadcastRing&) = delete;
+	BroadcastRing& operator=(const BroadcastRing&&) = delete;
+
+	/// Adds a consumer that starts at the current position and only reads elements every consumer in depends_on
+	/// has released. Must be called before the producer and consumers start running.
+	Consumer &add_consumer(std::initializer_list<const Consumer *> depends_on = {})
+	{
+		consumers_.push_back(std::make_unique<Consumer>(*this, depends_on));
+
+		Consumer &consumer = *consumers_.back();
+		consumer.cursor_.store(published_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		consumer.cached_limit_ = consumer.cursor_.load(std::memory_order_relaxed);
+		return consumer;
+	}
+
+	/// Next slot to fill, spinning while the slowest consumer is a full lap behind.
+	T* get_next_write_loc() noexcept
+	{
+		const size_t published = published_.load(std::memory_order_relaxed);
+
+		while (published - cached_gate_ == capacity_ && published - refresh_gate() == capacity_)
+		{
+			cpu_relax();
+		}
+
+		return &store_[published & mask_];
+	}
+
+	/// Publishes the slot to every consumer with a single release store.
+	void update_write_idx() noexcept
+	{
+		published_.store(published_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	size_t capacity() const noexcept
+	{
+		return capacity_;
+	}
+
+	size_t published() const noexcept
+	{
+		return published_.load(std::memory_order_acquire);
+	}
+};
+
+#endif //LOWLATENCYFINTECH_BROADCAST_RING_H
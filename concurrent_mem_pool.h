@@ -0,0 +1,368 @@
+#ifndef LOWLATENCYFINTECH_CONCURRENT_MEM_POOL_H
+#define LOWLATENCYFINTECH_CONCURRENT_MEM_POOL_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <unordered_set>
+#include <pthread.h>
+
+#include "macros.h"
+#include "mem_utils.h"
+
+constexpr size_t POOL_MAX_THREADS = 64;
+constexpr size_t POOL_THREAD_CACHE_SIZE = 4;
+constexpr uint32_t POOL_BATCH = 32;
+
+/* Fixed capacity object pool that can be allocated from and freed to on any thread, e.g. the gateway allocates orders
+ * and the matching engine frees them.
+ *
+ * Every thread that touches the pool gets its own cache, and every block belongs to the cache that first took it from
+ * the pool. Allocating pops the calling thread's own free list and freeing a block it owns pushes it back, neither
+ * touches an atomic. A block freed by another thread is collected on that thread in a per-owner batch and handed
+ * back with a single CAS once POOL_BATCH of them are waiting (or on flush()); the owner takes the whole returned list
+ * with one exchange when its own list runs dry, before it carves another POOL_BATCH fresh blocks out of the store.
+ * Once the store is all carved, a thread that runs dry takes over another cache's returned list instead, so capacity
+ * parked with one thread is not lost to the others. A thread leaving hands its own free list to that returned list
+ * and flushes its remote batches, so nothing stays stranded with a thread that has exited.
+ *
+ * Objects are constructed in place on allocate() and destroyed on deallocate(). Objects still allocated when the pool
+ * goes away are not destroyed. As with any pool, a pointer must reach the freeing thread through something that
+ * synchronises (an LFQueue, a lock), which is also what makes the block's owner visible to it.
+ *
+ * A thread that frees blocks it does not own should call flush() when it goes idle, otherwise up to POOL_BATCH - 1
+ * blocks per owner stay parked with it.
+ */
+template<typename T>
+class ConcurrentMemPool final
+{
+private:
+	static constexpr uint32_t NIL = UINT32_MAX;
+
+	struct RemoteBatch
+	{
+		uint32_t head_ = NIL;
+		uint32_t tail_ = NIL;
+		uint32_t count_ = 0;
+	};
+
+	struct alignas(Common::CACHE_LINE_SIZE) ThreadCache
+	{
+		// Only ever touched by the owning thread.
+		uint32_t free_head_ = NIL;
+		uint8_t id_ = 0;
+		pthread_t thread_ = {};
+		RemoteBatch remote_batches_[POOL_MAX_THREADS];
+
+		// Pushed to by every other thread, drained by the owner.
+		alignas(Common::CACHE_LINE_SIZE) std::atomic<uint32_t> returned_head_ = {NIL};
+	};
+
+	struct CacheEntry
+	{
+		uint64_t pool_id_ = 0;
+		ThreadCache *cache_ = nullptr;
+	};
+
+	struct ExitEntry
+	{
+		uint64_t pool_id_ = 0;
+		ConcurrentMemPool *pool_ = nullptr;
+		ThreadCache *cache_ = nullptr;
+	};
+
+	/// Releases the exiting thread's caches in every pool that is still alive.
+	struct ThreadExit
+	{
+		std::vector<ExitEntry> entries_;
+
+		~ThreadExit()
+		{
+			std::lock_guard<std::mutex> lock(live_pools_mutex_);
+			for (const ExitEntry &entry : entries_)
+			{
+				if (live_pools_.contains(entry.pool_id_))
+				{
+					entry.pool_->release_cache(*entry.cache_);
+				}
+			}
+		}
+	};
+
+	const size_t capacity_;
+	const uint64_t id_;
+	Common::Arena arena_;
+	T *store_ = nullptr;
+
+	// Free list links and the owning cache of every block, kept apart from the objects.
+	std::vector<uint32_t> next_;
+	std::vector<uint8_t> owner_;
+
+	// Caches are only ever appended, cache_count_ publishes a new one.
+	ThreadCache *caches_[POOL_MAX_THREADS] = {};
+	std::atomic<size_t> cache_count_ = 0;
+	std::mutex caches_mutex_;
+
+	// Blocks [fresh_, capacity_) have never been handed to a cache.
+	alignas(Common::CACHE_LINE_SIZE) std::atomic<size_t> fresh_ = 0;
+
+	static inline std::atomic<uint64_t> next_pool_id_ = 1;
+
+	// Pools not destroyed yet, a thread exiting after its pool went away must not touch it.
+	static inline std::mutex live_pools_mutex_;
+	static inline std::unordered_set<uint64_t> live_pools_;
+
+	/// Finds the calling thread's cache through a small thread_local cache keyed on the pool id, like Logger's lanes.
+	ThreadCache &local_cache() noexcept
+	{
+		thread_local CacheEntry entries[POOL_THREAD_CACHE_SIZE];
+		thread_local size_t next_victim = 0;
+
+		for (const CacheEntry &entry : entries)
+		{
+			if (entry.pool_id_ == id_) [[likely]]
+			{
+				return *entry.cache_;
+			}
+		}
+
+		CacheEntry &entry = entries[next_victim];
+		next_victim = (next_victim + 1) % POOL_THREAD_CACHE_SIZE;
+		entry.pool_id_ = id_;
+		entry.cache_ = register_cache();
+		return *entry.cache_;
+	}
+
+	/// Slow path, once per thread (again after its entry was evicted, which finds the existing cache).
+	ThreadCache *register_cache()
+	{
+		std::lock_guard<std::mutex> lock(caches_mutex_);
+
+		ThreadCache *cache = nullptr;
+		const size_t cache_count = cache_count_.load(std::memory_order_relaxed);
+		for (size_t i = 0; i < cache_count && !cache; i++)
+		{
+			if (pthread_equal(caches_[i]->thread_, pthread_self()))
+			{
+				cache = caches_[i];
+			}
+		}
+
+		if (!cache)
+		{
+			ASSERT(cache_count < POOL_MAX_THREADS, "Too many threads using ConcurrentMemPool");
+
+			cache = caches_[cache_count] = new ThreadCache();
+			cache->id_ = static_cast<uint8_t>(cache_count);
+			cache->thread_ = pthread_self();
+			cache_count_.store(cache_count + 1, std::memory_order_release);
+		}
+
+		// A thread reusing the id of one that exited takes over its released cache.
+		thread_local ThreadExit thread_exit;
+		const bool known = std::any_of(thread_exit.entries_.begin(), thread_exit.entries_.end(),
+		                               [this](const ExitEntry &entry) { return entry.pool_id_ == id_; });
+		if (!known)
+		{
+			thread_exit.entries_.push_back({id_, this, cache});
+		}
+
+		return cache;
+	}
+
+	/// The calling thread is exiting: give its free blocks and parked remote batches back.
+	void release_cache(ThreadCache &cache) noexcept
+	{
+		for (size_t owner = 0; owner < cache_count_.load(std::memory_order_acquire); owner++)
+		{
+			if (cache.remote_batches_[owner].count_ != 0)
+			{
+				return_batch(static_cast<uint8_t>(owner), cache.remote_batches_[owner]);
+			}
+		}
+
+		if (cache.free_head_ != NIL)
+		{
+			RemoteBatch own {cache.free_head_, cache.free_head_, 1};
+			while (next_[own.tail_] != NIL)
+			{
+				own.tail_ = next_[own.tail_];
+				own.count_++;
+			}
+			cache.free_head_ = NIL;
+			return_batch(cache.id_, own);
+		}
+	}
+
+	/// The owner's free list ran dry: adopt everything other threads returned, or else carve fresh blocks.
+	void refill(ThreadCache &cache) noexcept
+	{
+		if (cache.returned_head_.load(std::memory_order_relaxed) != NIL)
+		{
+			cache.free_head_ = cache.returned_head_.exchange(NIL, std::memory_order_acquire);
+			return;
+		}
+
+		const size_t begin = fresh_.fetch_add(POOL_BATCH, std::memory_order_relaxed);
+		if (begin >= capacity_) [[unlikely]]
+		{
+			steal(cache);
+			return;
+		}
+
+		const size_t end = std::min<size_t>(begin + POOL_BATCH, capacity_);
+		for (size_t i = begin; i < end; i++)
+		{
+			next_[i] = i + 1 < end ? static_cast<uint32_t>(i + 1) : NIL;
+			owner_[i] = cache.id_;
+		}
+
+		cache.free_head_ = static_cast<uint32_t>(begin);
+	}
+
+	/// The store is all carved: take over the blocks returned to another cache, starting after our own.
+	void steal(ThreadCache &cache) noexcept
+	{
+		const size_t cache_count = cache_count_.load(std::memory_order_acquire);
+		for (size_t i = 1; i < cache_count; i++)
+		{
+			std::atomic<uint32_t> &returned_head = caches_[(cache.id_ + i) % cache_count]->returned_head_;
+			if (returned_head.load(std::memory_order_relaxed) == NIL)
+			{
+				continue;
+			}
+
+			const uint32_t head = returned_head.exchange(NIL, std::memory_order_acquire);
+			for (uint32_t idx = head; idx != NIL; idx = next_[idx])
+			{
+				owner_[idx] = cache.id_;
+			}
+			if (head != NIL)
+			{
+				cache.free_head_ = head;
+				return;
+			}
+		}
+
+		FATAL("ConcurrentMemPool out of Memory (blocks may be parked in unflushed remote batches)");
+	}
+
+	/// Hands a batch of blocks back to their owner with one CAS.
+	void return_batch(uint8_t owner, RemoteBatch &batch) noexcept
+	{
+		std::atomic<uint32_t> &returned_head = caches_[owner]->returned_head_;
+		uint32_t head = returned_head.load(std::memory_order_relaxed);
+
+		do
+		{
+			next_[batch.tail_] = head;
+		} while (!returned_head.compare_exchange_weak(head, batch.head_, std::memory_order_release,
+		                                              std::memory_order_relaxed));
+
+		batch = {};
+	}
+
+public:
+	explicit ConcurrentMemPool(size_t num_elements, const Common::ArenaConfig &arena = {}) : capacity_(num_elements),
+		id_(next_pool_id_.fetch_add(1)), arena_(num_elements * sizeof(T), arena),
+		store_(static_cast<T *>(arena_.data())), next_(num_elements), owner_(num_elements)
+	{
+		ASSERT(num_elements < NIL, "ConcurrentMemPool too large: " + std::to_string(num_elements));
+
+		std::lock_guard<std::mutex> lock(live_pools_mutex_);
+		live_pools_.insert(id_);
+	}
+
+	~ConcurrentMemPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(live_pools_mutex_);
+			live_pools_.erase(id_);
+		}
+
+		for (size_t i = 0; i < cache_count_.load(); i++)
+		{
+			delete caches_[i];
+		}
+	}
+
+	ConcurrentMemPool() = delete;
+	ConcurrentMemPool(const ConcurrentMemPool&) = delete;
+	ConcurrentMemPool(const ConcurrentMemPool&&) = delete;
+	ConcurrentMemPool& operator=(const ConcurrentMemPool&) = delete;
+	ConcurrentMemPool& operator=(const ConcurrentMemPool&&) = delete;
+
+	template<typename... Args>
+	T* allocate(Args&&... args) noexcept
+	{
+		ThreadCache &cache = local_cache();
+
+		if (cache.free_head_ == NIL) [[unlikely]]
+		{
+			refill(cache);
+		}
+
+		const uint32_t idx = cache.free_head_;
+		cache.free_head_ = next_[idx];
+
+		return new(&store_[idx]) T(std::forward<Args>(args)...);
+	}
+
+	void deallocate(const T* elem) noexcept
+	{
+		const auto elem_index = elem - store_;
+		ASSERT(elem_index >= 0 && static_cast<size_t>(elem_index) < capacity_,
+		       "Element being deallocated does not belong in this memory pool");
+
+		const auto idx = static_cast<uint32_t>(elem_index);
+		elem->~T();
+
+		ThreadCache &cache = local_cache();
+		const uint8_t owner = owner_[idx];
+
+		if (owner == cache.id_) [[likely]]
+		{
+			next_[idx] = cache.free_head_;
+			cache.free_head_ = idx;
+			return;
+		}
+
+		RemoteBatch &batch = cache.remote_batches_[owner];
+		next_[idx] = batch.head_;
+		if (batch.head_ == NIL)
+		{
+			batch.tail_ = idx;
+		}
+		batch.head_ = idx;
+
+		if (++batch.count_ == POOL_BATCH)
+		{
+			return_batch(owner, batch);
+		}
+	}
+
+	/// Returns every partial batch of blocks the calling thread freed for other threads.
+	void flush() noexcept
+	{
+		ThreadCache &cache = local_cache();
+
+		for (size_t owner = 0; owner < cache_count_.load(std::memory_order_acquire); owner++)
+		{
+			if (cache.remote_batches_[owner].count_ != 0)
+			{
+				return_batch(static_cast<uint8_t>(owner), cache.remote_batches_[owner]);
+			}
+		}
+	}
+
+	size_t capacity() const noexcept
+	{
+		return capacity_;
+	}
+};
+
+#endif //LOWLATENCYFINTECH_CONCURRENT_MEM_POOL_H
@@ -0,0 +1,421 @@
+#ifndef LOWLATENCYFINTECH_FEED_HANDLER_H
+#define LOWLATENCYFINTECH_FEED_HANDLER_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <sys/uio.h>
+
+#include "macros.h"
+#include "mem_utils.h"
+#include "time_utils.h"
+#include "thread_utils.h"
+#include "socket_utils.h"
+#include "io_uring.h"
+#include "market_data.h"
+#include "Logger.h"
+
+namespace Common
+{
+	struct FeedHandlerConfig
+	{
+		unsigned int batch_ = 64; // packets per recvmmsg(), one preallocated buffer each
+		uint32_t max_channels_ = 16;
+		int rcv_buf_ = 8 * 1024 * 1024; // socket receive buffer, what a burst can queue up while we are busy
+		bool kernel_timestamps_ = true; // SO_TIMESTAMPNS on every packet
+		ArenaConfig arena_ = {}; // for the packet buffers
+
+		IoBackend backend_ = IoBackend::EPOLL; // EPOLL is the recvmmsg() loop, IO_URING falls back to it if refused
+		IoUringConfig uring_ = {};
+		unsigned int uring_buffers_ = 256; // provided packet buffers, a power of two
+	};
+
+	struct FeedStats
+	{
+		uint64_t packets_ = 0; // accepted, in sequence or after a gap
+		uint64_t updates_ = 0;
+		uint64_t gaps_ = 0; // times a channel skipped ahead
+		uint64_t missed_packets_ = 0; // packets skipped over by those gaps
+		uint64_t stale_packets_ = 0; // repeated or late, dropped
+		uint64_t bad_packets_ = 0; // truncated, malformed or for a channel out of range, dropped
+		uint64_t dropped_updates_ = 0; // refused by a full non-blocking queue
+		uint64_t recv_calls_ = 0; // recvmmsg() calls, or io_uring polls, that returned packets
+		uint64_t ring_enters_ = 0; // io_uring_enter() calls
+		uint64_t buffer_shortages_ = 0; // io_uring receives stopped for want of a free provided buffer
+	};
+
+	/* Multicast market data receiver for one group.
+	 *
+	 * The constructor joins the group and preallocates batch_ packet buffers in an Arena with one iovec and mmsghdr
+	 * each, so a single recvmmsg() drains up to batch_ datagrams straight into them and nothing is allocated
+	 * afterwards. Packets are decoded in place right away, which leaves the buffers free for the next call.
+	 *
+	 * Every channel's next expected sequence number is kept. A packet behind it is a duplicate or arrived late and is
+	 * dropped; a packet ahead of it means packets were lost, which is counted and logged, and the handler carries on
+	 * from the new number with gap_before_ set on the first update it hands on so the consumer can resynchronise.
+	 * The first packet seen on a channel sets its sequence.
+	 *
+	 * Updates go to an MDUpdateQueue tagged with channel, packet sequence, the publisher's send time, the kernel's
+	 * receive time (SO_TIMESTAMPNS, read from each packet's control message) and the time recvmmsg() returned, claimed
+	 * and published a packet at a time. poll() runs on the handler's own thread after start(), or inline from the
+	 * consumer; stats() is only consistent from that thread or after stop().
+	 *
+	 * With backend_ IO_URING the socket is a fixed file with one multishot IORING_OP_RECVMSG armed on it, which lands
+	 * each datagram, its control message and an io_uring_recvmsg_out header in a buffer of its own from a provided
+	 * buffer ring. poll() then only walks the completion ring and gives the buffers back, the kernel keeps receiving
+	 * in between without being asked; read_ts_ becomes the time poll() reaped the completions.
+	 */
+	class FeedHandler final
+	{
+	private:
+		const FeedHandlerConfig config_;
+		MDUpdateQueue *updates_;
+		Logger &logger_;
+		const std::string ip_;
+		int fd_ = -1;
+
+		Arena packets_;
+		std::vector<iovec> iovecs_;
+		std::vector<mmsghdr> msgs_;
+		std::vector<RxTimestampControl> controls_;
+		std::vector<uint64_t> next_seq_; // per channel, 0 until its first packet
+
+#ifndef __APPLE__
+		std::unique_ptr<IoUring> ring_;
+		std::unique_ptr<IoUringBufRing> rx_buffers_;
+		msghdr uring_msg_ {}; // tells the multishot recvmsg how much name and control space to leave in each buffer
+#endif
+
+		FeedStats stats_;
+
+		std::atomic<bool> running_ = false;
+		std::thread *thread_ = nullptr;
+
+		uint8_t *packet(size_t i) const noexcept
+		{
+			return static_cast<uint8_t *>(packets_.data()) + i * MD_MAX_PACKET;
+		}
+
+		void on_packet(const uint8_t *data, size_t len, int flags, nanos recv_ts, nanos read_ts) noexcept
+		{
+			MDPacketHeader header;
+			if ((flags & MSG_TRUNC) || len < sizeof(header)) [[unlikely]]
+			{
+				stats_.bad_packets_++;
+				return;
+			}
+
+			std::memcpy(&header, data, sizeof(header));
+			if (header.channel_ >= config_.max_channels_ || header.count_ > MD_MAX_UPDATES ||
+			    len != sizeof(header) + header.count_ * sizeof(MarketUpdate)) [[unlikely]]
+			{
+				stats_.bad_packets_++;
+				return;
+			}
+
+			uint64_t &next_seq = next_seq_[header.channel_];
+			const bool gap = next_seq != 0 && header.seq_ > next_seq;
+			if (next_seq != 0 && header.seq_ < next_seq) [[unlikely]]
+			{
+				stats_.stale_packets_++;
+				return;
+			}
+			if (gap) [[unlikely]]
+			{
+				stats_.gaps_++;
+				stats_.missed_packets_ += header.seq_ - next_seq;
+				logger_.log("FeedHandler % gap on channel %: expected seq % got %\n", ip_, header.channel_, next_seq,
+				            header.seq_);
+			}
+			next_seq = header.seq_ + 1;
+			stats_.packets_++;
+
+			const uint8_t *payload = data + sizeof(header);
+			const LFQSpans<MDUpdate> slots = updates_->get_next_write_locs(header.count_);
+			for (size_t i = 0; i < slots.size(); i++)
+			{
+				MDUpdate &update = slots[i];
+				update.channel_ = header.channel_;
+				update.gap_before_ = gap && i == 0;
+				update.seq_ = header.seq_;
+				update.send_ts_ = header.send_ts_;
+				update.recv_ts_ = recv_ts;
+				update.read_ts_ = read_ts;
+				std::memcpy(&update.update_, payload + i * sizeof(MarketUpdate), sizeof(MarketUpdate));
+			}
+			updates_->update_write_idx(slots.size());
+
+			stats_.updates_ += slots.size();
+			stats_.dropped_updates_ += header.count_ - slots.size();
+		}
+
+#ifndef __APPLE__
+		void setup_uring() noexcept
+		{
+			auto ring = std::make_unique<IoUring>(config_.uring_);
+			if (!ring->valid())
+			{
+				logger_.log("FeedHandler % io_uring setup failed errno:%, using recvmmsg()\n", ip_,
+				            strerror(ring->error()));
+				return;
+			}
+			if (const int err = ring->register_files(&fd_, 1); err < 0)
+			{
+				logger_.log("FeedHandler % io_uring file registration failed errno:%, using recvmmsg()\n", ip_,
+				            strerror(-err));
+				return;
+			}
+
+			uring_msg_.msg_controllen = config_.kernel_timestamps_ ? sizeof(RxTimestampControl::buf_) : 0;
+			auto buffers = std::make_unique<IoUringBufRing>(*ring, 0, config_.uring_buffers_,
+			                                                sizeof(io_uring_recvmsg_out) + uring_msg_.msg_controllen +
+			                                                MD_MAX_PACKET, config_.arena_);
+			if (!buffers->valid())
+			{
+				logger_.log("FeedHandler % io_uring has no provided buffer rings, using recvmmsg()\n", ip_);
+				return;
+			}
+
+			ring_ = std::move(ring);
+			rx_buffers_ = std::move(buffers);
+			arm_recv();
+			ring_->submit();
+		}
+
+		void arm_recv() noexcept
+		{
+			io_uring_sqe *sqe = ring_->get_sqe();
+			while (!sqe) [[unlikely]]
+			{
+				ring_->submit();
+				sqe = ring_->get_sqe();
+			}
+			sqe->opcode = IORING_OP_RECVMSG;
+			sqe->fd = 0;
+			sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+			sqe->ioprio = IORING_RECV_MULTISHOT;
+			sqe->addr = reinterpret_cast<uint64_t>(&uring_msg_);
+			sqe->len = 1;
+			sqe->buf_group = rx_buffers_->group();
+		}
+
+		size_t poll_uring() noexcept
+		{
+			const nanos read_ts = get_ns();
+			size_t packets = 0;
+			bool rearm = false;
+
+			ring_->for_each_cqe([&](const io_uring_cqe &cqe)
+			{
+				if (cqe.flags & IORING_CQE_F_BUFFER)
+				{
+					const uint16_t id = IoUringBufRing::buffer_id(cqe);
+					if (cqe.res > 0)
+					{
+						// Buffer layout: io_uring_recvmsg_out, the (empty) name, the control space, the payload.
+						const uint8_t *buffer = rx_buffers_->buffer(id);
+						io_uring_recvmsg_out out;
+						std::memcpy(&out, buffer, sizeof(out));
+						uint8_t *control = const_cast<uint8_t *>(buffer) + sizeof(out) + uring_msg_.msg_namelen;
+
+						nanos recv_ts = read_ts;
+						if (config_.kernel_timestamps_)
+						{
+							msghdr msg {};
+							msg.msg_control = control;
+							msg.msg_controllen = out.controllen;
+							const nanos kernel_ts = rx_timestamp(msg);
+							recv_ts = kernel_ts ? kernel_ts : read_ts;
+						}
+						on_packet(control + uring_msg_.msg_controllen, out.payloadlen, static_cast<int>(out.flags),
+						          recv_ts, read_ts);
+						packets++;
+					}
+					rx_buffers_->recycle(id);
+				}
+				else if (cqe.res < 0 && cqe.res != -ENOBUFS) [[unlikely]]
+				{
+					logger_.log("FeedHandler % io_uring recvmsg failed errno:%\n", ip_, strerror(-cqe.res));
+				}
+
+				if (!(cqe.flags & IORING_CQE_F_MORE))
+				{
+					stats_.buffer_shortages_ += cqe.res == -ENOBUFS;
+					rearm = true;
+				}
+			});
+
+			if (rearm)
+			{
+				arm_recv();
+			}
+			// No syscall unless there is the re-arm to submit or completions overflowed the ring.
+			ring_->submit();
+			stats_.ring_enters_ = ring_->enters();
+			stats_.recv_calls_ += packets != 0;
+			return packets;
+		}
+#endif
+
+		void run() noexcept
+		{
+			logger_.log("FeedHandler % started, fd: % batch: % backend: %\n", ip_, fd_, config_.batch_,
+			            backend() == IoBackend::IO_URING ? "io_uring" : "recvmmsg");
+
+			while (running_.load(std::memory_order_acquire))
+			{
+				if (poll() == 0)
+				{
+					cpu_relax();
+				}
+			}
+
+			logger_.log("FeedHandler % stopped, packets: % gaps: % missed: %\n", ip_, stats_.packets_, stats_.gaps_,
+			            stats_.missed_packets_);
+		}
+
+	public:
+		/// Joins the multicast group ip on the interface iface ("lo" for a feed on this host) and binds port.
+		FeedHandler(MDUpdateQueue *updates, Logger &logger, const std::string &ip, const std::string &iface, int port,
+		            const FeedHandlerConfig &config = {}) : config_(config), updates_(updates), logger_(logger),
+			ip_(ip), packets_(config.batch_ * MD_MAX_PACKET, config.arena_), iovecs_(config.batch_),
+			msgs_(config.batch_), controls_(config.kernel_timestamps_ ? config.batch_ : 0),
+			next_seq_(config.max_channels_, 0)
+		{
+			ASSERT(config_.batch_ != 0, "FeedHandler needs at least one packet buffer");
+			ASSERT(is_multicast(ip_), "FeedHandler needs a multicast group, got " + ip_);
+
+			fd_ = create_socket(logger_, ip_, iface, port, true, false, true, 0, config_.kernel_timestamps_);
+			ASSERT(fd_ != -1, "FeedHandler failed to join " + ip_ + " on " + iface);
+			if (!set_rcv_buf(fd_, config_.rcv_buf_))
+			{
+				logger_.log("FeedHandler % set_rcv_buf() failed errno:%\n", ip_, strerror(errno));
+			}
+
+			for (size_t i = 0; i < config_.batch_; i++)
+			{
+				iovecs_[i] = {packet(i), MD_MAX_PACKET};
+				msgs_[i] = {};
+				msgs_[i].msg_hdr.msg_iov = &iovecs_[i];
+				msgs_[i].msg_hdr.msg_iovlen = 1;
+				if (config_.kernel_timestamps_)
+				{
+					msgs_[i].msg_hdr.msg_control = controls_[i].buf_;
+					msgs_[i].msg_hdr.msg_controllen = sizeof(controls_[i].buf_);
+				}
+			}
+
+#ifndef __APPLE__
+			if (config_.backend_ == IoBackend::IO_URING)
+			{
+				setup_uring();
+			}
+#endif
+		}
+
+		~FeedHandler()
+		{
+			stop();
+			if (fd_ != -1)
+			{
+				close(fd_);
+			}
+		}
+
+		FeedHandler() = delete;
+		FeedHandler(const FeedHandler&) = delete;
+		FeedHandler(const FeedHandler&&) = delete;
+		FeedHandler& operator=(const FeedHandler&) = delete;
+		FeedHandler& operator=(const FeedHandler&&) = delete;
+
+		/// Runs the receive loop on its own thread pinned to core_id (-1 leaves it unpinned).
+		void start(int core_id)
+		{
+			running_ = true;
+			thread_ = launch_thread(core_id, "Trading/FeedHandler", [this]()
+			{
+				run();
+			});
+			ASSERT(thread_ != nullptr, "Failed to start feed handler thread");
+		}
+
+		void stop()
+		{
+			if (!thread_)
+			{
+				return;
+			}
+
+			running_ = false;
+			thread_->join();
+			delete thread_;
+			thread_ = nullptr;
+		}
+
+		/// One recvmmsg() into the packet buffers and every packet it returned decoded, or every io_uring completion
+		/// reaped, returns how many packets.
+		size_t poll() noexcept
+		{
+#ifndef __APPLE__
+			if (ring_)
+			{
+				return poll_uring();
+			}
+#endif
+
+			const int received = recv_mmsg(fd_, msgs_.data(), config_.batch_);
+			if (received <= 0)
+			{
+				if (received < 0 && errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR) [[unlikely]]
+				{
+					logger_.log("FeedHandler % recvmmsg() failed errno:%\n", ip_, strerror(errno));
+				}
+				return 0;
+			}
+
+			const nanos read_ts = get_ns();
+			stats_.recv_calls_++;
+
+			for (int i = 0; i < received; i++)
+			{
+				msghdr &msg = msgs_[i].msg_hdr;
+				nanos recv_ts = read_ts;
+				if (config_.kernel_timestamps_)
+				{
+					const nanos kernel_ts = rx_timestamp(msg);
+					recv_ts = kernel_ts ? kernel_ts : read_ts;
+					msg.msg_controllen = sizeof(controls_[i].buf_); // the kernel shrank it to what it wrote
+				}
+				on_packet(packet(i), msgs_[i].msg_len, msg.msg_flags, recv_ts, read_ts);
+			}
+
+			return static_cast<size_t>(received);
+		}
+
+		const FeedStats &stats() const noexcept
+		{
+			return stats_;
+		}
+
+		/// The backend actually in use, EPOLL if IO_URING was asked for and the kernel refused it.
+		IoBackend backend() const noexcept
+		{
+#ifndef __APPLE__
+			return ring_ ? IoBackend::IO_URING : IoBackend::EPOLL;
+#else
+			return IoBackend::EPOLL;
+#endif
+		}
+
+		int fd() const noexcept
+		{
+			return fd_;
+		}
+	};
+}
+
+#endif //LOWLATENCYFINTECH_FEED_HANDLER_H
@@ -0,0 +1,236 @@
+#ifndef LOWLATENCYFINTECH_FLAT_TABLES_H
+#define LOWLATENCYFINTECH_FLAT_TABLES_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <bit>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "macros.h"
+
+namespace Common
+{
+	/* Table for dense integer keys (order ids, client ids): the key is the index. One load, no hashing, no probing;
+	 * keys past the capacity simply are not found. Slots not set hold the empty value given at construction.
+	 */
+	template<typename V>
+	class DirectIndex final
+	{
+	private:
+		std::vector<V> slots_;
+		const V empty_;
+
+	public:
+		DirectIndex(size_t capacity, V empty) : slots_(capacity, empty), empty_(empty)
+		{
+		}
+
+		DirectIndex() = delete;
+		DirectIndex(const DirectIndex&) = delete;
+		DirectIndex(const DirectIndex&&) = delete;
+		DirectIndex& operator=(const DirectIndex&) = delete;
+		DirectIndex& operator=(const DirectIndex&&) = delete;
+
+		V find(uint64_t key) const noexcept
+		{
+			return key < slots_.size() ? slots_[key] : empty_;
+		}
+
+		/// The slot of a key that must be below capacity().
+		V &operator[](uint64_t key) noexcept
+		{
+			ASSERT(key < slots_.size(), "DirectIndex key out of range");
+			return slots_[key];
+		}
+
+		void erase(uint64_t key) noexcept
+		{
+			(*this)[key] = empty_;
+		}
+
+		size_t capacity() const noexcept
+		{
+			return slots_.size();
+		}
+	};
+
+	/* Open addressing hash map from sparse 64 bit keys (prices in ticks) to small values (level pointers), for a
+	 * known maximum number of entries such as a MemPool's capacity.
+	 *
+	 * Keys probe linearly from their home slot. Besides keys and values every slot has a one byte tag: 0 for empty,
+	 * otherwise the top bit set and 7 more bits of the key's hash. A lookup compares 16 tags at once (SSE2) against the
+	 * wanted tag and against empty, and only reads the keys whose tags matched, stopping at the first empty slot. The
+	 * first 16 tags are mirrored past the end so a group starting near the end does not need to wrap.
+	 *
+	 * Erase shifts the following entries of the probe run back into the hole instead of leaving a tombstone, so the
+	 * table never degrades however many prices come and go. Sized for at most half full.
+	 */
+	template<typename V>
+	class FlatPriceMap final
+	{
+	private:
+		static constexpr size_t GROUP = 16;
+		static constexpr uint8_t EMPTY = 0;
+
+		const size_t capacity_;
+		const size_t mask_;
+		const int shift_;
+		std::vector<uint8_t> tags_;
+		std::vector<int64_t> keys_;
+		std::vector<V> values_;
+		size_t size_ = 0;
+
+		/// Fibonacci hashing: the top bits of key * 2^64 / phi, which spread runs of neighbouring prices evenly.
+		static uint64_t hash(int64_t key) noexcept
+		{
+			return static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ULL;
+		}
+
+		size_t home(uint64_t h) const noexcept
+		{
+			return h >> shift_;
+		}
+
+		/// The 7 hash bits right below the ones home() used.
+		uint8_t tag_of(uint64_t h) const noexcept
+		{
+			return static_cast<uint8_t>(0x80 | ((h >> (shift_ - 7)) & 0x7F));
+		}
+
+		void set_tag(size_t pos, uint8_t tag) noexcept
+		{
+			tags_[pos] = tag;
+			if (pos < GROUP)
+			{
+				tags_[capacity_ + pos] = tag;
+			}
+		}
+
+		/// Bit i set for each of the 16 tags from pos equal to tag.
+		uint32_t match(size_t pos, uint8_t tag) const noexcept
+		{
+#if defined(__SSE2__)
+			const __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&tags_[pos]));
+			return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(static_cast<char>(tag)))));
+#else
+			uint32_t bits = 0;
+			for (size_t i = 0; i < GROUP; i++)
+			{
+				bits |= static_cast<uint32_t>(tags_[pos + i] == tag) << i;
+			}
+			return bits;
+#endif
+		}
+
+		/// Slot holding key, or capacity_ when it is not in the table.
+		size_t find_slot(int64_t key) const noexcept
+		{
+			const uint64_t h = hash(key);
+			const uint8_t tag = tag_of(h);
+
+			for (size_t pos = home(h);; pos = (pos + GROUP) & mask_)
+			{
+				const uint32_t empty = match(pos, EMPTY);
+				// Only candidates before the first empty slot belong to this probe run.
+				uint32_t candidates = match(pos, tag) & (empty ? (empty & -empty) - 1 : 0xFFFF);
+
+				while (candidates)
+				{
+					const size_t slot = (pos + std::countr_zero(candidates)) & mask_;
+					if (keys_[slot] == key) [[likely]]
+					{
+						return slot;
+					}
+					candidates &= candidates - 1;
+				}
+
+				if (empty)
+				{
+					return capacity_;
+				}
+			}
+		}
+
+	public:
+		explicit FlatPriceMap(size_t max_entries) : capacity_(std::bit_ceil(std::max<size_t>(2 * max_entries, GROUP))),
+			mask_(capacity_ - 1), shift_(64 - std::countr_zero(capacity_)), tags_(capacity_ + GROUP, EMPTY),
+			keys_(capacity_), values_(capacity_)
+		{
+		}
+
+		FlatPriceMap() = delete;
+		FlatPriceMap(const FlatPriceMap&) = delete;
+		FlatPriceMap(const FlatPriceMap&&) = delete;
+		FlatPriceMap& operator=(const FlatPriceMap&) = delete;
+		FlatPriceMap& operator=(const FlatPriceMap&&) = delete;
+
+		/// The value stored for key, or empty when there is none.
+		V find(int64_t key, V empty = V()) const noexcept
+		{
+			const size_t slot = find_slot(key);
+			return slot != capacity_ ? values_[slot] : empty;
+		}
+
+		/// Adds a key that is not in the table yet.
+		void insert(int64_t key, V value) noexcept
+		{
+			ASSERT(2 * size_ < capacity_, "FlatPriceMap over half full");
+
+			const uint64_t h = hash(key);
+			size_t pos = home(h);
+			while (tags_[pos] != EMPTY)
+			{
+				pos = (pos + 1) & mask_;
+			}
+
+			set_tag(pos, tag_of(h));
+			keys_[pos] = key;
+			values_[pos] = value;
+			size_++;
+		}
+
+		/// Removes key if present, pulling later entries of its probe run back so no tombstone is needed.
+		bool erase(int64_t key) noexcept
+		{
+			size_t hole = find_slot(key);
+			if (hole == capacity_)
+			{
+				return false;
+			}
+
+			for (size_t next = (hole + 1) & mask_; tags_[next] != EMPTY; next = (next + 1) & mask_)
+			{
+				// An entry may move into the hole only if its home slot is not after the hole in the probe order.
+				const size_t next_home = home(hash(keys_[next]));
+				if (((next - next_home) & mask_) >= ((next - hole) & mask_))
+				{
+					set_tag(hole, tags_[next]);
+					keys_[hole] = keys_[next];
+					values_[hole] = values_[next];
+					hole = next;
+				}
+			}
+
+			set_tag(hole, EMPTY);
+			size_--;
+			return true;
+		}
+
+		size_t size() const noexcept
+		{
+			return size_;
+		}
+
+		size_t capacity() const noexcept
+		{
+			return capacity_;
+		}
+	};
+}
+
+#endif //LOWLATENCYFINTECH_FLAT_TABLES_H
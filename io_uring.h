@@ -0,0 +1,495 @@
+#ifndef LOWLATENCYFINTECH_IO_URING_H
+#define LOWLATENCYFINTECH_IO_URING_H
+
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cerrno>
+#include <cstring>
+
+#include "macros.h"
+#include "mem_utils.h"
+
+namespace Common
+{
+	/// How a component talks to the kernel. EPOLL is the plain socket and file calls each component was written
+	/// with (epoll for TCP, recvmmsg() for feeds, writev() for logs), IO_URING goes through an IoUring instead and
+	/// falls back to EPOLL when the kernel will not give it one.
+	enum class IoBackend : int8_t
+	{
+		EPOLL = 0,
+		IO_URING = 1
+	};
+
+	struct IoUringConfig
+	{
+		unsigned int entries_ = 1024; // submission queue size, the completion queue gets twice as many
+		bool sqpoll_ = false; // a kernel thread polls the submission queue, ring setup retries without it if refused
+		int sqpoll_cpu_ = -1; // pin that thread, -1 leaves it to the scheduler
+		unsigned int sqpoll_idle_ms_ = 1000; // it sleeps after this long without work, submit() wakes it again
+	};
+}
+
+#ifndef __APPLE__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace Common
+{
+	/* A single issuer io_uring set up with raw syscalls, so there is no liburing dependency: the submission and
+	 * completion rings are mapped once, get_sqe() hands out the next free entry and submit() publishes everything
+	 * filled since the last call.
+	 *
+	 * Without SQPOLL submit() is one io_uring_enter() for any number of entries. With SQPOLL it is not a syscall at
+	 * all while the kernel thread is awake, only a store to the tail; the thread is woken with io_uring_enter() only
+	 * when it flagged that it went to sleep. Completions are read straight from the mapped ring by for_each_cqe().
+	 *
+	 * valid() is false when the kernel refused the ring (too old, io_uring_disabled, seccomp) and error() says why,
+	 * every user is expected to fall back to its EPOLL path then.
+	 */
+	class IoUring final
+	{
+	private:
+		int fd_ = -1;
+		int error_ = 0;
+		bool sqpoll_ = false;
+
+		void *sq_map_ = MAP_FAILED;
+		size_t sq_map_size_ = 0;
+		void *cq_map_ = MAP_FAILED;
+		size_t cq_map_size_ = 0;
+		io_uring_sqe *sqes_ = static_cast<io_uring_sqe *>(MAP_FAILED);
+		size_t sqes_size_ = 0;
+
+		unsigned *sq_head_ = nullptr;
+		unsigned *sq_tail_ = nullptr;
+		unsigned *sq_flags_ = nullptr;
+		unsigned sq_mask_ = 0;
+		unsigned sq_entries_ = 0;
+
+		unsigned *cq_head_ = nullptr;
+		unsigned *cq_tail_ = nullptr;
+		io_uring_cqe *cqes_ = nullptr;
+		unsigned cq_mask_ = 0;
+
+		unsigned sq_local_tail_ = 0; // filled by get_sqe(), published by submit()
+		unsigned to_submit_ = 0;
+		uint64_t enters_ = 0;
+
+		static unsigned load_acquire(unsigned *p) noexcept
+		{
+			return std::atomic_ref<unsigned>(*p).load(std::memory_order_acquire);
+		}
+
+		static void store_release(unsigned *p, unsigned v) noexcept
+		{
+			std::atomic_ref<unsigned>(*p).store(v, std::memory_order_release);
+		}
+
+		int enter(unsigned to_submit, unsigned min_complete, unsigned flags) noexcept
+		{
+			enters_++;
+			const int n = static_cast<int>(syscall(__NR_io_uring_enter, fd_, to_submit, min_complete, flags, nullptr,
+			                                       0));
+			return n == -1 ? -errno : n;
+		}
+
+		bool setup(const IoUringConfig &config, bool sqpoll) noexcept
+		{
+			io_uring_params params {};
+			if (sqpoll)
+			{
+				params.flags |= IORING_SETUP_SQPOLL;
+				params.sq_thread_idle = config.sqpoll_idle_ms_;
+				if (config.sqpoll_cpu_ >= 0)
+				{
+					params.flags |= IORING_SETUP_SQ_AFF;
+					params.sq_thread_cpu = static_cast<unsigned>(config.sqpoll_cpu_);
+				}
+			}
+
+			fd_ = static_cast<int>(syscall(__NR_io_uring_setup, config.entries_, &params));
+			if (fd_ == -1)
+			{
+				error_ = errno;
+				return false;
+			}
+			sqpoll_ = sqpoll;
+			error_ = 0;
+
+			sq_map_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			cq_map_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			if (params.features & IORING_FEAT_SINGLE_MMAP)
+			{
+				sq_map_size_ = cq_map_size_ = std::max(sq_map_size_, cq_map_size_);
+			}
+
+			sq_map_ = mmap(nullptr, sq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+			               IORING_OFF_SQ_RING);
+			cq_map_ = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq_map_ :
+			          mmap(nullptr, cq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+			               IORING_OFF_CQ_RING);
+			sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+			sqes_ = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+			                                         MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+			if (sq_map_ == MAP_FAILED || cq_map_ == MAP_FAILED || sqes_ == MAP_FAILED)
+			{
+				error_ = errno;
+				return false;
+			}
+
+			char *sq = static_cast<char *>(sq_map_);
+			sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+			sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+			sq_flags_ = reinterpret_cast<unsigned *>(sq + params.sq_off.flags);
+			sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+			sq_entries_ = params.sq_entries;
+			sq_local_tail_ = *sq_tail_;
+
+			// Entry i always sits in slot i, so the indirection array is filled once and never touched again.
+			unsigned *array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+			for (unsigned i = 0; i < sq_entries_; i++)
+			{
+				array[i] = i;
+			}
+
+			char *cq = static_cast<char *>(cq_map_);
+			cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+			cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+			cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+			cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+			return true;
+		}
+
+		void teardown() noexcept
+		{
+			if (sqes_ != MAP_FAILED)
+			{
+				munmap(sqes_, sqes_size_);
+			}
+			if (cq_map_ != MAP_FAILED && cq_map_ != sq_map_)
+			{
+				munmap(cq_map_, cq_map_size_);
+			}
+			if (sq_map_ != MAP_FAILED)
+			{
+				munmap(sq_map_, sq_map_size_);
+			}
+			if (fd_ != -1)
+			{
+				close(fd_);
+			}
+
+			fd_ = -1;
+			sq_map_ = cq_map_ = MAP_FAILED;
+			sqes_ = static_cast<io_uring_sqe *>(MAP_FAILED);
+		}
+
+		int register_op(unsigned opcode, const void *arg, unsigned count) noexcept
+		{
+			const int n = static_cast<int>(syscall(__NR_io_uring_register, fd_, opcode, arg, count));
+			return n == -1 ? -errno : n;
+		}
+
+	public:
+		explicit IoUring(const IoUringConfig &config = {}) noexcept
+		{
+			// SQPOLL needs CAP_SYS_NICE on older kernels and may be blocked by policy, plain rings usually are not.
+			if (config.sqpoll_ && setup(config, true))
+			{
+				return;
+			}
+			teardown();
+			if (!setup(config, false))
+			{
+				teardown();
+			}
+		}
+
+		~IoUring()
+		{
+			teardown();
+		}
+
+		IoUring(const IoUring&) = delete;
+		IoUring(const IoUring&&) = delete;
+		IoUring& operator=(const IoUring&) = delete;
+		IoUring& operator=(const IoUring&&) = delete;
+
+		[[nodiscard]] bool valid() const noexcept
+		{
+			return fd_ != -1;
+		}
+
+		/// Why the ring could not be set up, 0 when valid().
+		[[nodiscard]] int error() const noexcept
+		{
+			return error_;
+		}
+
+		[[nodiscard]] bool sqpoll() const noexcept
+		{
+			return sqpoll_;
+		}
+
+		/// io_uring_enter() calls so far, the syscalls submit() and wait() could not avoid.
+		[[nodiscard]] uint64_t enters() const noexcept
+		{
+			return enters_;
+		}
+
+		/// The next submission entry, zeroed, or nullptr when the submission queue is full (submit() and retry).
+		io_uring_sqe *get_sqe() noexcept
+		{
+			if (sq_local_tail_ - load_acquire(sq_head_) >= sq_entries_) [[unlikely]]
+			{
+				return nullptr;
+			}
+
+			io_uring_sqe *sqe = &sqes_[sq_local_tail_ & sq_mask_];
+			std::memset(sqe, 0, sizeof(*sqe));
+			sq_local_tail_++;
+			to_submit_++;
+			return sqe;
+		}
+
+		/// Hands every entry taken since the last call to the kernel, and moves completions that overflowed the
+		/// completion queue back into it. Returns how many entries were submitted, or -errno.
+		int submit() noexcept
+		{
+			const bool overflow = std::atomic_ref<unsigned>(*sq_flags_).load(std::memory_order_relaxed) &
+			                      IORING_SQ_CQ_OVERFLOW;
+			if (to_submit_ == 0 && !overflow)
+			{
+				return 0;
+			}
+
+			store_release(sq_tail_, sq_local_tail_);
+			const unsigned submitted = to_submit_;
+			to_submit_ = 0;
+
+			if (sqpoll_)
+			{
+				// The kernel thread checks the tail before it sets NEED_WAKEUP, so our tail store must be ordered
+				// before the flag load.
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				unsigned flags = overflow ? IORING_ENTER_GETEVENTS : 0;
+				if (std::atomic_ref<unsigned>(*sq_flags_).load(std::memory_order_relaxed) & IORING_SQ_NEED_WAKEUP)
+				{
+					flags |= IORING_ENTER_SQ_WAKEUP;
+				}
+				if (flags)
+				{
+					enter(0, 0, flags);
+				}
+				return static_cast<int>(submitted);
+			}
+
+			for (;;)
+			{
+				const int n = enter(submitted, 0, overflow ? IORING_ENTER_GETEVENTS : 0);
+				if (n != -EINTR)
+				{
+					return n;
+				}
+			}
+		}
+
+		/// Submits anything pending and blocks until at least min_complete completions are waiting.
+		int wait(unsigned min_complete) noexcept
+		{
+			store_release(sq_tail_, sq_local_tail_);
+			const unsigned submitted = sqpoll_ ? 0 : to_submit_;
+			to_submit_ = 0;
+
+			unsigned flags = IORING_ENTER_GETEVENTS;
+			if (sqpoll_ && (std::atomic_ref<unsigned>(*sq_flags_).load(std::memory_order_relaxed) &
+			                IORING_SQ_NEED_WAKEUP))
+			{
+				flags |= IORING_ENTER_SQ_WAKEUP;
+			}
+
+			for (;;)
+			{
+				const int n = enter(submitted, min_complete, flags);
+				if (n != -EINTR)
+				{
+					return n;
+				}
+			}
+		}
+
+		/// Calls f(const io_uring_cqe &) for every completion waiting, returns how many.
+		template<typename F>
+		unsigned for_each_cqe(F &&f)
+		{
+			unsigned head = *cq_head_;
+			const unsigned tail = load_acquire(cq_tail_);
+			const unsigned count = tail - head;
+
+			for (; head != tail; head++)
+			{
+				f(cqes_[head & cq_mask_]);
+			}
+			if (count)
+			{
+				store_release(cq_head_, head);
+			}
+			return count;
+		}
+
+		/// Registers count file slots, fds[i] or -1 for an empty slot to fill later with update_file().
+		int register_files(const int *fds, unsigned count) noexcept
+		{
+			return register_op(IORING_REGISTER_FILES, fds, count);
+		}
+
+		/// Puts fd (or -1 to empty it) in fixed file slot index.
+		int update_file(unsigned index, int fd) noexcept
+		{
+			io_uring_files_update update {};
+			update.offset = index;
+			update.fds = reinterpret_cast<uint64_t>(&fd);
+			return register_op(IORING_REGISTER_FILES_UPDATE, &update, 1);
+		}
+
+		/// Pins count buffers for the *_FIXED opcodes, which then skip the per request page lookups.
+		int register_buffers(const iovec *buffers, unsigned count) noexcept
+		{
+			return register_op(IORING_REGISTER_BUFFERS, buffers, count);
+		}
+
+		int register_buf_ring(io_uring_buf_reg &reg) noexcept
+		{
+			return register_op(IORING_REGISTER_PBUF_RING, &reg, 1);
+		}
+
+		int unregister_buf_ring(uint16_t group) noexcept
+		{
+			io_uring_buf_reg reg {};
+			reg.bgid = group;
+			return register_op(IORING_UNREGISTER_PBUF_RING, &reg, 1);
+		}
+	};
+
+	/* Provided buffers for multishot receives: count buffers of size bytes in one Arena, registered as buffer group
+	 * group of a ring. The kernel picks a buffer for every completion and reports its id in the cqe flags; whoever
+	 * consumed the data gives it back with recycle(), which is a store to the ring's tail and no syscall.
+	 */
+	class IoUringBufRing final
+	{
+	private:
+		IoUring &ring_;
+		const uint16_t group_;
+		const unsigned count_;
+		const size_t size_;
+		Arena entries_;
+		Arena buffers_;
+		// The ring is an array of io_uring_buf whose first entry's resv field is the tail. Not io_uring_buf_ring::bufs:
+		// __DECLARE_FLEX_ARRAY puts an empty struct in front of it, which takes a byte in C++ and moves bufs by 8.
+		io_uring_buf *bufs_ = nullptr;
+		uint16_t tail_ = 0;
+		bool registered_ = false;
+
+		void add(uint16_t id) noexcept
+		{
+			io_uring_buf &buf = bufs_[tail_ & (count_ - 1)];
+			buf.addr = reinterpret_cast<uint64_t>(buffer(id));
+			buf.len = static_cast<uint32_t>(size_);
+			buf.bid = id;
+			tail_++;
+		}
+
+		void publish() noexcept
+		{
+			std::atomic_ref<uint16_t>(bufs_[0].resv).store(tail_, std::memory_order_release);
+		}
+
+	public:
+		/// count must be a power of two, at most 32768.
+		IoUringBufRing(IoUring &ring, uint16_t group, unsigned count, size_t size, const ArenaConfig &arena = {}) :
+			ring_(ring), group_(group), count_(count), size_(size), entries_(count * sizeof(io_uring_buf), arena),
+			buffers_(count * size, arena)
+		{
+			ASSERT(count_ != 0 && (count_ & (count_ - 1)) == 0 && count_ <= 32768,
+			       "IoUringBufRing needs a power of two buffer count");
+
+			bufs_ = static_cast<io_uring_buf *>(entries_.data());
+			for (unsigned i = 0; i < count_; i++)
+			{
+				add(static_cast<uint16_t>(i));
+			}
+			publish();
+
+			io_uring_buf_reg reg {};
+			reg.ring_addr = reinterpret_cast<uint64_t>(bufs_);
+			reg.ring_entries = count_;
+			reg.bgid = group_;
+			registered_ = ring_.register_buf_ring(reg) == 0;
+		}
+
+		~IoUringBufRing()
+		{
+			if (registered_)
+			{
+				ring_.unregister_buf_ring(group_);
+			}
+		}
+
+		IoUringBufRing() = delete;
+		IoUringBufRing(const IoUringBufRing&) = delete;
+		IoUringBufRing(const IoUringBufRing&&) = delete;
+		IoUringBufRing& operator=(const IoUringBufRing&) = delete;
+		IoUringBufRing& operator=(const IoUringBufRing&&) = delete;
+
+		/// False if the kernel has no provided buffer rings (before 5.19).
+		[[nodiscard]] bool valid() const noexcept
+		{
+			return registered_;
+		}
+
+		uint16_t group() const noexcept
+		{
+			return group_;
+		}
+
+		size_t size() const noexcept
+		{
+			return size_;
+		}
+
+		uint8_t *buffer(uint16_t id) const noexcept
+		{
+			return static_cast<uint8_t *>(buffers_.data()) + id * size_;
+		}
+
+		/// The id of the buffer a completion landed in, only meaningful when it has IORING_CQE_F_BUFFER set.
+		static uint16_t buffer_id(const io_uring_cqe &cqe) noexcept
+		{
+			return static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+		}
+
+		/// Gives a buffer back to the kernel once its data has been consumed.
+		void recycle(uint16_t id) noexcept
+		{
+			add(id);
+			publish();
+		}
+	};
+
+	/// Whether this kernel lets the process set up an io_uring at all, for picking a backend up front.
+	inline bool io_uring_available() noexcept
+	{
+		IoUringConfig config;
+		config.entries_ = 4;
+		return IoUring(config).valid();
+	}
+}
+#endif
+
+#endif //LOWLATENCYFINTECH_IO_URING_H
@@ -9,22 +9,164 @@
 #include <vector>
 #include <pthread.h>
 #include <atomic>
+#include <bit>
+#include <span>
+#include <algorithm>
+#include <cstdlib>
 
 #include "macros.h"
+#include "mem_utils.h"
+#include "thread_utils.h"
 
-template<typename T>
+/// A run of queue slots, split in two when it wraps around the end of the store.
+template<typename S>
+struct LFQSpans
+{
+	std::span<S> first_;
+	std::span<S> second_;
+
+	[[nodiscard]] size_t size() const noexcept
+	{
+		return first_.size() + second_.size();
+	}
+
+	[[nodiscard]] bool empty() const noexcept
+	{
+		return first_.empty();
+	}
+
+	S &operator[](size_t i) const noexcept
+	{
+		return i < first_.size() ? first_[i] : second_[i - first_.size()];
+	}
+};
+
+/// What the producer side does when the consumer has not freed a slot yet.
+enum class LFQOverflow : int8_t
+{
+	BLOCK = 0,       // spin until the consumer frees a slot
+	DROP_NEWEST = 1, // hand out a scratch slot instead and count the element as dropped, callers need no changes
+	FAIL_FAST = 2    // get_next_write_loc() returns nullptr and try_push() returns false
+};
+
+/* Single producer single consumer queue.
+ *
+ * The indices only ever grow and are masked into the power of two store, so there is no modulo and size is simply
+ * write - read. Each side owns one index on its own cache line together with a private copy of the other side's
+ * index: the producer only re-reads read_idx_ when its cached copy says the queue is full and the consumer only
+ * re-reads write_idx_ when its copy says the queue is empty, so in steady state neither side touches the other's
+ * cache line. Publication is a release store paired with an acquire load, nothing needs to be sequentially
+ * consistent.
+ *
+ * A full queue never overwrites unread elements, the LFQOverflow policy picked per instance decides whether the
+ * producer waits, drops or fails. The producer also tracks an occupancy high-water mark from its cached view of the
+ * read index, which can only over-report, so a consumer falling behind shows up before anything is lost.
+ *
+ * Checked queues (the default outside NDEBUG builds) remember the first producer and consumer thread and fail fast on
+ * overflow, underflow or a second thread using a side. Names are only looked up once a check has failed, so the cost
+ * is a pthread_self() compare and one extra index load per operation. Release queues carry no checks at all.
+ */
+template<typename T, bool Checked = CHECKED_BUILD>
 class LFQueue final
 {
 private:
-	std::vector<T> store_;
-	std::atomic<size_t> next_write_index_ = {0};
-	std::atomic<size_t> next_read_index_ = {0};
+	// Backed by an Arena and, for trivially copyable T, only committed as the producer first reaches each page unless
+	// the arena prefaults it. One extra slot past the ring is the scratch slot DROP_NEWEST hands out when it is full,
+	// like every slot not written yet it then holds zero bytes rather than T{}.
+	const size_t capacity_;
+	const size_t mask_;
+	const LFQOverflow overflow_;
+	Common::Arena arena_;
+	T *store_ = nullptr;
+
+	// Producer cache line.
+	alignas(Common::CACHE_LINE_SIZE) std::atomic<size_t> write_idx_ = {0};
+	size_t cached_read_idx_ = 0;
+	bool dropping_ = false;
+	std::atomic<size_t> dropped_ = {0};
+	std::atomic<size_t> high_water_mark_ = {0};
+	pthread_t producer_ = {};
+	bool has_producer_ = false;
+
+	// Consumer cache line.
+	alignas(Common::CACHE_LINE_SIZE) std::atomic<size_t> read_idx_ = {0};
+	mutable size_t cached_write_idx_ = 0;
+	pthread_t consumer_ = {};
+	bool has_consumer_ = false;
 
-	std::atomic<size_t> num_elements_ = {0};
+	char padding_[Common::CACHE_LINE_SIZE - sizeof(std::atomic<size_t>) - sizeof(size_t) - sizeof(pthread_t) -
+	              sizeof(bool)];
+
+	[[noreturn]] static void fail(const char *what) noexcept
+	{
+		char thread_name[64] = {'\0'};
+		pthread_getname_np(pthread_self(), thread_name, sizeof(thread_name));
+		FATAL(std::string(what) + " in thread: " + thread_name);
+		std::abort();
+	}
+
+	/// Refreshes the cached read index until n slots are free, or just once unless the policy is BLOCK.
+	bool wait_for_room(size_t write_idx, size_t n) noexcept
+	{
+		cached_read_idx_ = read_idx_.load(std::memory_order_acquire);
+
+		while (capacity_ - (write_idx - cached_read_idx_) < n)
+		{
+			if (overflow_ != LFQOverflow::BLOCK)
+			{
+				return false;
+			}
+
+			cpu_relax();
+			cached_read_idx_ = read_idx_.load(std::memory_order_acquire);
+		}
+
+		return true;
+	}
+
+	LFQSpans<T> spans(size_t idx, size_t n) const noexcept
+	{
+		const size_t begin = idx & mask_;
+		const size_t first = std::min(n, capacity_ - begin);
+		return {std::span<T>(store_ + begin, first), std::span<T>(store_, n - first)};
+	}
+
+	static void check_thread(pthread_t &owner, bool &has_owner, const char *what) noexcept
+	{
+		if (!has_owner) [[unlikely]]
+		{
+			owner = pthread_self();
+			has_owner = true;
+		}
+		else if (!pthread_equal(owner, pthread_self())) [[unlikely]]
+		{
+			fail(what);
+		}
+	}
 
 public:
-	LFQueue(size_t num_elems) : store_(num_elems, T())
+	explicit LFQueue(size_t num_elems, LFQOverflow overflow = LFQOverflow::BLOCK, const Common::ArenaConfig &arena = {}) :
+		capacity_(std::bit_ceil(num_elems)), mask_(capacity_ - 1), overflow_(overflow),
+		arena_((capacity_ + 1) * sizeof(T), arena), store_(static_cast<T *>(arena_.data()))
 	{
+		if constexpr (!Common::is_lazily_committable<T>)
+		{
+			for (size_t i = 0; i <= capacity_; i++)
+			{
+				new(&store_[i]) T();
+			}
+		}
+	}
+
+	~LFQueue()
+	{
+		if constexpr (!Common::is_lazily_committable<T>)
+		{
+			for (size_t i = 0; i <= capacity_; i++)
+			{
+				store_[i].~T();
+			}
+		}
 	}
 
 	LFQueue() = delete;
@@ -35,40 +177,177 @@ public:
 
 	T* get_next_write_loc() noexcept
 	{
-		return &store_[next_write_index_];
+		const size_t write_idx = write_idx_.load(std::memory_order_relaxed);
+
+		if (write_idx - cached_read_idx_ == capacity_) [[unlikely]]
+		{
+			if (!wait_for_room(write_idx, 1))
+			{
+				if (overflow_ == LFQOverflow::FAIL_FAST)
+				{
+					return nullptr;
+				}
+
+				dropping_ = true;
+				return &store_[capacity_];
+			}
+		}
+
+		return &store_[write_idx & mask_];
+	}
+
+	/// Copies value into the next slot and publishes it. Returns false if the overflow policy dropped or refused it.
+	bool try_push(const T &value) noexcept
+	{
+		T *slot = get_next_write_loc();
+		if (!slot)
+		{
+			return false;
+		}
+
+		*slot = value;
+		return update_write_idx();
+	}
+
+	/// Claims up to n contiguous free slots for the producer to fill in place. BLOCK queues wait for all n, the other
+	/// policies hand out fewer when the consumer is behind. Nothing is visible to the consumer until
+	/// update_write_idx(count) publishes them.
+	LFQSpans<T> get_next_write_locs(size_t n) noexcept
+	{
+		const size_t write_idx = write_idx_.load(std::memory_order_relaxed);
+		n = std::min(n, capacity_);
+
+		if (capacity_ - (write_idx - cached_read_idx_) < n)
+		{
+			wait_for_room(write_idx, n);
+		}
+
+		return spans(write_idx, std::min(n, capacity_ - (write_idx - cached_read_idx_)));
 	}
 
-	void update_write_idx() noexcept
+	/// Publishes the next n written slots with a single release store. Returns false if the slot handed out by
+	/// get_next_write_loc() was the DROP_NEWEST scratch slot, in which case the element is counted as dropped.
+	bool update_write_idx(size_t n = 1) noexcept
 	{
-		next_write_index_ = (next_write_index_ + 1) % store_.size();
-		num_elements_++;
+		const size_t write_idx = write_idx_.load(std::memory_order_relaxed);
+
+		if (dropping_) [[unlikely]]
+		{
+			dropping_ = false;
+			dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		if constexpr (Checked)
+		{
+			check_thread(producer_, has_producer_, "LFQueue written by a second producer");
+
+			if (write_idx + n - cached_read_idx_ > capacity_)
+			{
+				cached_read_idx_ = read_idx_.load(std::memory_order_acquire);
+				if (write_idx + n - cached_read_idx_ > capacity_) [[unlikely]]
+				{
+					fail("LFQueue overflow, unread element overwritten");
+				}
+			}
+		}
+
+		write_idx_.store(write_idx + n, std::memory_order_release);
+
+		if (write_idx + n - cached_read_idx_ > high_water_mark_.load(std::memory_order_relaxed))
+		{
+			high_water_mark_.store(write_idx + n - cached_read_idx_, std::memory_order_relaxed);
+		}
+
+		return true;
+	}
+
+	/// Producer side: whether n more slots can be written before the consumer has to catch up. Only looks at the
+	/// consumer's index when the cached copy says there is not enough room.
+	bool can_write(size_t n = 1) noexcept
+	{
+		const size_t write_idx = write_idx_.load(std::memory_order_relaxed);
+
+		if (capacity_ - (write_idx - cached_read_idx_) < n)
+		{
+			cached_read_idx_ = read_idx_.load(std::memory_order_acquire);
+		}
+
+		return capacity_ - (write_idx - cached_read_idx_) >= n;
 	}
 
 	const T* get_next_to_read() const noexcept
 	{
-		if (next_read_index_ == next_write_index_)
+		const size_t read_idx = read_idx_.load(std::memory_order_relaxed);
+
+		if (read_idx == cached_write_idx_)
 		{
-			return nullptr;
+			cached_write_idx_ = write_idx_.load(std::memory_order_acquire);
+
+			if (read_idx == cached_write_idx_)
+			{
+				return nullptr;
+			}
 		}
 
-		return &store_[next_read_index_];
+		return &store_[read_idx & mask_];
 	}
 
-	void update_read_idx() noexcept
+	/// Every element published so far, with one acquire load of the producer's index.
+	LFQSpans<const T> get_all_to_read() const noexcept
 	{
-		next_read_index_ = (next_read_index_ + 1) % store_.size();
+		const size_t read_idx = read_idx_.load(std::memory_order_relaxed);
+		cached_write_idx_ = write_idx_.load(std::memory_order_acquire);
 
-		char thread_name[64];
-		pthread_getname_np(pthread_self(), thread_name, sizeof(thread_name));
-		std::string thread_name_str(thread_name);
+		const LFQSpans<T> available = spans(read_idx, cached_write_idx_ - read_idx);
+		return {available.first_, available.second_};
+	}
 
-		ASSERT(num_elements_ != 0, "Read an invalid element in: " + thread_name_str);
-		num_elements_--;
+	/// Releases the next n read slots back to the producer with a single release store.
+	void update_read_idx(size_t n = 1) noexcept
+	{
+		const size_t read_idx = read_idx_.load(std::memory_order_relaxed);
+
+		if constexpr (Checked)
+		{
+			check_thread(consumer_, has_consumer_, "LFQueue read by a second consumer");
+
+			if (cached_write_idx_ - read_idx < n)
+			{
+				cached_write_idx_ = write_idx_.load(std::memory_order_acquire);
+				if (cached_write_idx_ - read_idx < n) [[unlikely]]
+				{
+					fail("LFQueue underflow, read an invalid element");
+				}
+			}
+		}
+
+		read_idx_.store(read_idx + n, std::memory_order_release);
 	}
 
+	/// Approximate when called while the other side is running. The read index is loaded first so the result
+	/// never underflows.
 	size_t size() const noexcept
 	{
-		return num_elements_.load();
+		const size_t read_idx = read_idx_.load(std::memory_order_acquire);
+		return write_idx_.load(std::memory_order_acquire) - read_idx;
+	}
+
+	size_t capacity() const noexcept
+	{
+		return capacity_;
+	}
+
+	/// Highest occupancy the producer has seen, measured against its cached read index so it may over-report.
+	size_t high_water_mark() const noexcept
+	{
+		return high_water_mark_.load(std::memory_order_relaxed);
+	}
+
+	/// Elements discarded by the DROP_NEWEST policy.
+	size_t dropped() const noexcept
+	{
+		return dropped_.load(std::memory_order_relaxed);
 	}
 };
 
@@ -0,0 +1,90 @@
+//
+// Offline formatter for logs written by Common::Logger in LogMode::BINARY.
+//
+// Usage: LogDecoder <binary log> [output file]
+//
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Logger.h"
+
+template<typename V>
+bool read_field(std::istream &in, V &value)
+{
+	return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof(V)));
+}
+
+int main(int argc, char **argv)
+{
+	using namespace Common;
+
+	if (argc < 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " <binary log> [output file]\n";
+		return EXIT_FAILURE;
+	}
+
+	std::ifstream in(argv[1], std::ios::binary);
+	ASSERT(in.is_open(), std::string("Could not open binary log: ") + argv[1]);
+
+	std::ofstream file_out;
+	if (argc > 2)
+	{
+		file_out.open(argv[2]);
+		ASSERT(file_out.is_open(), std::string("Could not open output file: ") + argv[2]);
+	}
+	std::ostream &out = argc > 2 ? file_out : std::cout;
+
+	char magic[sizeof(LOG_BINARY_MAGIC)];
+	in.read(magic, sizeof(magic));
+	ASSERT(in && std::equal(magic, magic + sizeof(magic), LOG_BINARY_MAGIC), "Not a binary Logger file");
+
+	std::vector<std::string> formats;
+	std::vector<std::vector<LogChunk>> chunks;
+	std::vector<char> args;
+	char tag;
+
+	while (in.get(tag))
+	{
+		uint32_t id;
+		uint32_t len;
+
+		if (tag == LOG_BINARY_FORMAT)
+		{
+			ASSERT(read_field(in, id) && read_field(in, len), "Truncated format entry");
+
+			if (id >= formats.size())
+			{
+				formats.resize(id + 1);
+				chunks.resize(id + 1);
+			}
+
+			formats[id].resize(len);
+			ASSERT(static_cast<bool>(in.read(formats[id].data(), len)), "Truncated format entry");
+			chunks[id] = split_log_format(formats[id].c_str());
+		}
+		else if (tag == LOG_BINARY_RECORD)
+		{
+			nanos ts;
+			ASSERT(read_field(in, id) && read_field(in, ts) && read_field(in, len), "Truncated record");
+			ASSERT(id < formats.size(), "Record references unknown format id: " + std::to_string(id));
+
+			args.resize(len);
+			ASSERT(static_cast<bool>(in.read(args.data(), len)), "Truncated record");
+
+			if (!format_log_record(out, formats[id].c_str(), chunks[id], args.data(), args.size()))
+			{
+				std::cerr << "Malformed record at " << ts << " for format: " << formats[id] << '\n';
+			}
+		}
+		else
+		{
+			FATAL("Unknown entry in binary log");
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,791 @@
+#ifndef LOWLATENCYFINTECH_LOG_SINK_H
+#define LOWLATENCYFINTECH_LOG_SINK_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <streambuf>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "macros.h"
+#include "time_utils.h"
+#include "thread_utils.h"
+#include "mem_utils.h"
+#include "io_uring.h"
+
+namespace Common
+{
+	constexpr size_t LOG_STAGING_BUFFER_SIZE = 1024 * 1024;
+	constexpr size_t LOG_STAGING_BUFFERS = 4;
+	constexpr size_t LOG_PAGE_SIZE = 4096;
+	constexpr nanos LOG_SEGMENT_THREAD_PARK_NS = 10 * NANOS_TO_MILIS;
+
+	enum class LogSinkType : int8_t
+	{
+		FILE = 0,    // staged buffers written to one file with writev()
+		MMAP = 1,    // preallocated, pre-faulted memory mapped segments
+		IO_URING = 2 // staged buffers written asynchronously through an io_uring, FILE where that is refused
+	};
+
+	/// When the mmap sink asks the kernel to write dirty pages back.
+	enum class LogSyncPolicy : int8_t
+	{
+		NONE = 0,      // leave it to the kernel's writeback
+		ON_ROTATE = 1, // msync(MS_SYNC) a segment when it is sealed, off the hot path of the session
+		ON_FLUSH = 2   // msync(MS_ASYNC) the newly committed range every time the logger thread goes idle
+	};
+
+	/// Base of the logger output sinks: a streambuf whose put area the logger formats into, plus counters.
+	class LogSink : public std::streambuf
+	{
+	protected:
+		uint64_t bytes_written_ = 0;
+		uint64_t flushes_ = 0;
+
+	public:
+		[[nodiscard]] uint64_t bytes_written() const noexcept
+		{
+			return bytes_written_;
+		}
+
+		[[nodiscard]] uint64_t flushes() const noexcept
+		{
+			return flushes_;
+		}
+	};
+
+	/* Formatted text (or binary records) is staged in a few large buffers and written with a single writev() once
+	 * they are all full or the queue has been drained, so the file sees a handful of big writes instead of one
+	 * stream insertion per value.
+	 */
+	class LogFileSink final : public LogSink
+	{
+	private:
+		int fd_ = -1;
+		// One reservation for all staging buffers, committed as the logger first writes into it.
+		char *staging_ = nullptr;
+		char *buffers_[LOG_STAGING_BUFFERS];
+		size_t used_[LOG_STAGING_BUFFERS] = {};
+		size_t current_ = 0;
+
+		void reset_put_area() noexcept
+		{
+			setp(buffers_[current_], buffers_[current_] + LOG_STAGING_BUFFER_SIZE);
+		}
+
+	public:
+		explicit LogFileSink(const std::string &file_name)
+		{
+			fd_ = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			ASSERT(fd_ != -1, "Could not open log file: " + file_name);
+
+			staging_ = static_cast<char *>(reserve_memory(LOG_STAGING_BUFFERS * LOG_STAGING_BUFFER_SIZE));
+			for (size_t i = 0; i < LOG_STAGING_BUFFERS; i++)
+			{
+				buffers_[i] = staging_ + i * LOG_STAGING_BUFFER_SIZE;
+			}
+			reset_put_area();
+		}
+
+		~LogFileSink() override
+		{
+			flush();
+			close(fd_);
+			release_memory(staging_, LOG_STAGING_BUFFERS * LOG_STAGING_BUFFER_SIZE);
+		}
+
+		LogFileSink() = delete;
+
+		LogFileSink(const LogFileSink &) = delete;
+
+		LogFileSink(const LogFileSink &&) = delete;
+
+		LogFileSink &operator=(const LogFileSink &) = delete;
+
+		LogFileSink &operator=(const LogFileSink &&) = delete;
+
+		/// Writes every staged byte with one writev(), retrying on short writes.
+		void flush() noexcept
+		{
+			used_[current_] = pptr() - pbase();
+
+			iovec iov[LOG_STAGING_BUFFERS];
+			int iov_count = 0;
+			for (size_t i = 0; i <= current_; i++)
+			{
+				if (used_[i])
+				{
+					iov[iov_count++] = {buffers_[i], used_[i]};
+				}
+			}
+
+			int first = 0;
+			while (first < iov_count)
+			{
+				const ssize_t n = writev(fd_, iov + first, iov_count - first);
+				if (n == -1)
+				{
+					if (errno == EINTR)
+					{
+						continue;
+					}
+					std::cerr << "Logger writev() failed errno:" << strerror(errno) << '\n';
+					break;
+				}
+
+				bytes_written_ += n;
+				size_t left = n;
+				while (first < iov_count && left >= iov[first].iov_len)
+				{
+					left -= iov[first].iov_len;
+					first++;
+				}
+
+				if (first < iov_count)
+				{
+					iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + left;
+					iov[first].iov_len -= left;
+				}
+			}
+
+			flushes_++;
+			std::fill(std::begin(used_), std::end(used_), 0);
+			current_ = 0;
+			reset_put_area();
+		}
+
+	protected:
+		int_type overflow(int_type ch) override
+		{
+			used_[current_] = pptr() - pbase();
+
+			if (current_ + 1 == LOG_STAGING_BUFFERS)
+			{
+				flush();
+			}
+			else
+			{
+				current_++;
+				reset_put_area();
+			}
+
+			if (!traits_type::eq_int_type(ch, traits_type::eof()))
+			{
+				*pptr() = traits_type::to_char_type(ch);
+				pbump(1);
+			}
+			return traits_type::not_eof(ch);
+		}
+
+		int sync() override
+		{
+			flush();
+			return 0;
+		}
+	};
+
+#ifndef __APPLE__
+	/* The FILE sink's staging buffers, written without waiting for the writes: the buffers are registered with an
+	 * io_uring and the file is its fixed file, so every flush() submits the bytes formatted since the last one as an
+	 * IORING_OP_WRITE_FIXED at the file offset they belong at and returns, while the logger keeps formatting into the
+	 * rest of the same buffer. The kernel only ever reads the range it was given, and the writes may complete in any
+	 * order. Copying them into the page cache is left to io-wq worker threads; the logger only waits when it comes
+	 * round to a buffer with writes still in flight. With SQPOLL even the submit is no syscall while the kernel
+	 * thread is awake.
+	 *
+	 * bytes_written() counts completed writes, so it trails what was flushed until the kernel is done.
+	 */
+	class LogUringSink final : public LogSink
+	{
+	private:
+		int fd_ = -1;
+		IoUring ring_;
+		bool valid_ = false;
+		char *staging_ = nullptr;
+		char *buffers_[LOG_STAGING_BUFFERS];
+		uint64_t file_offset_[LOG_STAGING_BUFFERS] = {}; // where the buffer's first byte goes in the file
+		unsigned in_flight_[LOG_STAGING_BUFFERS] = {}; // writes submitted from the buffer and not completed
+		size_t current_ = 0;
+		size_t submitted_ = 0; // bytes of the current buffer already submitted
+
+		void reset_put_area() noexcept
+		{
+			setp(buffers_[current_], buffers_[current_] + LOG_STAGING_BUFFER_SIZE);
+		}
+
+		/// A write of buffer i's bytes [begin, begin + len), which the user data identifies for resubmitting the rest
+		/// of a short write.
+		void submit_write(size_t i, size_t begin, size_t len) noexcept
+		{
+			io_uring_sqe *sqe = ring_.get_sqe();
+			while (!sqe)
+			{
+				ring_.submit();
+				sqe = ring_.get_sqe();
+			}
+
+			sqe->opcode = IORING_OP_WRITE_FIXED;
+			sqe->fd = 0;
+			// Straight to an io-wq worker: tried inline, a buffered write would copy into the page cache on this
+			// thread, or fail with EAGAIN and be punted anyway.
+			sqe->flags = IOSQE_FIXED_FILE | IOSQE_ASYNC;
+			sqe->addr = reinterpret_cast<uint64_t>(buffers_[i] + begin);
+			sqe->len = static_cast<uint32_t>(len);
+			sqe->off = file_offset_[i] + begin;
+			sqe->buf_index = static_cast<uint16_t>(i);
+			sqe->user_data = static_cast<uint64_t>(len) << 32 | static_cast<uint64_t>(begin) << 8 | i;
+		}
+
+		void reap() noexcept
+		{
+			ring_.for_each_cqe([this](const io_uring_cqe &cqe)
+			{
+				const size_t i = cqe.user_data & 0xFF;
+				const size_t begin = (cqe.user_data >> 8) & 0xFFFFFF;
+				const size_t len = cqe.user_data >> 32;
+
+				size_t done = 0;
+				if (cqe.res > 0)
+				{
+					done = static_cast<size_t>(cqe.res);
+					bytes_written_ += done;
+				}
+				else if (cqe.res != -EINTR && cqe.res != -EAGAIN)
+				{
+					std::cerr << "Logger io_uring write failed errno:" << strerror(-cqe.res) << '\n';
+					done = len;
+				}
+
+				if (done < len)
+				{
+					submit_write(i, begin + done, len - done);
+				}
+				else
+				{
+					in_flight_[i]--;
+				}
+			});
+			ring_.submit();
+		}
+
+		void wait_for(size_t i) noexcept
+		{
+			reap();
+			while (in_flight_[i] != 0)
+			{
+				ring_.wait(1);
+				reap();
+			}
+		}
+
+		void submit_pending() noexcept
+		{
+			const size_t used = pptr() - pbase();
+			if (used != submitted_)
+			{
+				submit_write(current_, submitted_, used - submitted_);
+				in_flight_[current_]++;
+				submitted_ = used;
+			}
+			ring_.submit();
+		}
+
+	public:
+		LogUringSink(const std::string &file_name, const IoUringConfig &config) : ring_(config)
+		{
+			fd_ = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			ASSERT(fd_ != -1, "Could not open log file: " + file_name);
+
+			staging_ = static_cast<char *>(reserve_memory(LOG_STAGING_BUFFERS * LOG_STAGING_BUFFER_SIZE));
+			iovec iov[LOG_STAGING_BUFFERS];
+			for (size_t i = 0; i < LOG_STAGING_BUFFERS; i++)
+			{
+				buffers_[i] = staging_ + i * LOG_STAGING_BUFFER_SIZE;
+				iov[i] = {buffers_[i], LOG_STAGING_BUFFER_SIZE};
+			}
+			reset_put_area();
+
+			// Registering pins, and so commits, the staging buffers right away.
+			valid_ = ring_.valid() && ring_.register_buffers(iov, LOG_STAGING_BUFFERS) == 0 &&
+			         ring_.register_files(&fd_, 1) == 0;
+		}
+
+		~LogUringSink() override
+		{
+			if (valid_)
+			{
+				flush();
+				for (size_t i = 0; i < LOG_STAGING_BUFFERS; i++)
+				{
+					wait_for(i);
+				}
+			}
+			close(fd_);
+			release_memory(staging_, LOG_STAGING_BUFFERS * LOG_STAGING_BUFFER_SIZE);
+		}
+
+		LogUringSink() = delete;
+
+		LogUringSink(const LogUringSink &) = delete;
+
+		LogUringSink(const LogUringSink &&) = delete;
+
+		LogUringSink &operator=(const LogUringSink &) = delete;
+
+		LogUringSink &operator=(const LogUringSink &&) = delete;
+
+		/// False when the kernel refused the ring or the registrations, the logger then uses a LogFileSink instead.
+		[[nodiscard]] bool valid() const noexcept
+		{
+			return valid_;
+		}
+
+		[[nodiscard]] bool sqpoll() const noexcept
+		{
+			return ring_.sqpoll();
+		}
+
+		/// Submits everything staged so far and collects the writes that completed, without waiting for any.
+		void flush() noexcept
+		{
+			submit_pending();
+			reap();
+			flushes_++;
+		}
+
+	protected:
+		int_type overflow(int_type ch) override
+		{
+			// The current buffer is full: send the rest of it off and move to the next, once its writes are done.
+			submit_pending();
+			const uint64_t next_offset = file_offset_[current_] + submitted_;
+			current_ = (current_ + 1) % LOG_STAGING_BUFFERS;
+			wait_for(current_);
+			file_offset_[current_] = next_offset;
+			submitted_ = 0;
+			reset_put_area();
+
+			if (!traits_type::eq_int_type(ch, traits_type::eof()))
+			{
+				*pptr() = traits_type::to_char_type(ch);
+				pbump(1);
+			}
+			return traits_type::not_eof(ch);
+		}
+
+		int sync() override
+		{
+			flush();
+			return 0;
+		}
+	};
+#endif
+
+	constexpr char LOG_SEGMENT_MAGIC[8] = {'L', 'L', 'F', 'S', 'E', 'G', '1', '\n'};
+
+	/* First page of every mmap log segment. committed_ is the number of data bytes that are complete, the writer
+	 * stores it with release semantics after the bytes are in place, so a reader mapping the same file only needs an
+	 * acquire load to tail the segment. sealed_ is set once the writer moved on to the next segment.
+	 */
+	struct LogSegmentHeader
+	{
+		char magic_[8];
+		uint64_t index_;
+		uint64_t capacity_;
+		std::atomic<uint64_t> committed_;
+		std::atomic<uint32_t> sealed_;
+	};
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "Segment header is shared between processes");
+
+	inline std::string log_segment_name(const std::string &base_name, uint64_t index)
+	{
+		return base_name + "." + std::to_string(index);
+	}
+
+	/* Writes the log straight into memory mapped segment files named <base>.<index>. Each segment is preallocated with
+	 * fallocate() and every page is touched when it is created, so formatting into it never page faults or extends
+	 * the file. A background thread keeps a spare segment prepared and seals the segments the writer is done with, so
+	 * rotation (on size, or on time when rotate_interval_ns is set) is a swap to the spare plus a futex wake. The
+	 * writer only waits for that thread when it rotates faster than a segment can be created and pre-faulted.
+	 */
+	class LogMmapSink final : public LogSink
+	{
+	private:
+		struct Segment
+		{
+			int fd_ = -1;
+			char *map_ = nullptr;
+			LogSegmentHeader *header_ = nullptr;
+		};
+
+		const std::string base_name_;
+		const size_t segment_size_;
+		const nanos rotate_interval_ns_;
+		const LogSyncPolicy sync_policy_;
+
+		Segment current_;
+		nanos segment_open_ns_ = 0;
+		size_t synced_ = 0;
+
+		// Handed between the writer and the segment thread, each slot is owned by whoever its flag says.
+		Segment spare_;
+		Segment retired_;
+		std::atomic<bool> spare_ready_ = false;
+		std::atomic<bool> retired_ready_ = false;
+
+		// Segment thread only.
+		uint64_t next_index_ = 0;
+
+		std::atomic<bool> running_ = true;
+		std::atomic<uint32_t> work_word_ = 0;
+		std::thread *segment_thread_ = nullptr;
+
+		char *data(const Segment &segment) const noexcept
+		{
+			return segment.map_ + LOG_PAGE_SIZE;
+		}
+
+		Segment create_segment()
+		{
+			Segment segment;
+			const std::string name = log_segment_name(base_name_, next_index_);
+
+			segment.fd_ = open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+			ASSERT(segment.fd_ != -1, "Could not open log segment: " + name);
+
+#ifndef __APPLE__
+			ASSERT(fallocate(segment.fd_, 0, 0, segment_size_) == 0, "fallocate() failed for " + name);
+#else
+			ASSERT(ftruncate(segment.fd_, segment_size_) == 0, "ftruncate() failed for " + name);
+#endif
+
+			void *map = mmap(nullptr, segment_size_, PROT_READ | PROT_WRITE, MAP_SHARED, segment.fd_, 0);
+			ASSERT(map != MAP_FAILED, "mmap() failed for " + name);
+			segment.map_ = static_cast<char *>(map);
+			madvise(segment.map_, segment_size_, MADV_SEQUENTIAL);
+
+			// Pre-fault: take every write fault now rather than while the session is logging.
+			for (size_t offset = 0; offset < segment_size_; offset += LOG_PAGE_SIZE)
+			{
+				*reinterpret_cast<volatile char *>(segment.map_ + offset) = 0;
+			}
+
+			segment.header_ = new(segment.map_) LogSegmentHeader {};
+			memcpy(segment.header_->magic_, LOG_SEGMENT_MAGIC, sizeof(LOG_SEGMENT_MAGIC));
+			segment.header_->index_ = next_index_++;
+			segment.header_->capacity_ = segment_size_ - LOG_PAGE_SIZE;
+
+			return segment;
+		}
+
+		void open_segment(const Segment &segment) noexcept
+		{
+			current_ = segment;
+			segment_open_ns_ = get_ns();
+			synced_ = 0;
+			setp(data(current_), data(current_) + current_.header_->capacity_);
+		}
+
+		/// Writes back, unmaps and closes a segment whose sealed_ flag has already been published to readers.
+		void seal(Segment &segment, bool last) noexcept
+		{
+			const uint64_t committed = segment.header_->committed_.load(std::memory_order_relaxed);
+
+			if (sync_policy_ != LogSyncPolicy::NONE)
+			{
+				msync(segment.map_, LOG_PAGE_SIZE + committed, MS_SYNC);
+			}
+
+			munmap(segment.map_, segment_size_);
+
+			// Only the final segment gives back its unused tail, mid session we keep away from file metadata.
+			if (last)
+			{
+				if (ftruncate(segment.fd_, LOG_PAGE_SIZE + committed) == -1)
+				{
+					std::cerr << "ftruncate() failed for " << base_name_ << " errno:" << strerror(errno) << '\n';
+				}
+			}
+
+			close(segment.fd_);
+			segment = {};
+		}
+
+		/// Makes everything formatted so far visible to readers.
+		uint64_t commit() noexcept
+		{
+			const uint64_t committed = pptr() - pbase();
+			const uint64_t previous = current_.header_->committed_.load(std::memory_order_relaxed);
+
+			if (committed != previous)
+			{
+				bytes_written_ += committed - previous;
+				current_.header_->committed_.store(committed, std::memory_order_release);
+			}
+
+			return committed;
+		}
+
+		void rotate() noexcept
+		{
+			while (!spare_ready_.load(std::memory_order_acquire) || retired_ready_.load(std::memory_order_acquire))
+			{
+				cpu_relax();
+			}
+
+			current_.header_->sealed_.store(1, std::memory_order_release);
+			retired_ = current_;
+			retired_ready_.store(true, std::memory_order_release);
+
+			open_segment(spare_);
+			spare_ready_.store(false, std::memory_order_release);
+
+			work_word_.fetch_add(1, std::memory_order_release);
+			unpark_threads(work_word_);
+		}
+
+		/// Seals retired segments and prepares the next spare, everything rotation used to do on the writer.
+		void run_segment_thread() noexcept
+		{
+			while (true)
+			{
+				const uint32_t word = work_word_.load(std::memory_order_acquire);
+				// Read before the retired slot, a rotation made before shutdown is always sealed here.
+				const bool running = running_.load(std::memory_order_acquire);
+
+				if (retired_ready_.load(std::memory_order_acquire))
+				{
+					seal(retired_, false);
+					retired_ready_.store(false, std::memory_order_release);
+				}
+
+				if (!running)
+				{
+					return;
+				}
+
+				if (!spare_ready_.load(std::memory_order_acquire))
+				{
+					spare_ = create_segment();
+					spare_ready_.store(true, std::memory_order_release);
+				}
+
+				park_thread(work_word_, word, LOG_SEGMENT_THREAD_PARK_NS);
+			}
+		}
+
+	public:
+		LogMmapSink(const std::string &base_name, size_t segment_size, nanos rotate_interval_ns,
+		            LogSyncPolicy sync_policy) : base_name_(base_name),
+			segment_size_((std::max(segment_size, 2 * LOG_PAGE_SIZE) + LOG_PAGE_SIZE - 1) & ~(LOG_PAGE_SIZE - 1)),
+			rotate_interval_ns_(rotate_interval_ns), sync_policy_(sync_policy)
+		{
+			open_segment(create_segment());
+			spare_ = create_segment();
+			spare_ready_.store(true, std::memory_order_release);
+
+			segment_thread_ = launch_thread(-1, "Common/LogSegments", [this]()
+			{
+				run_segment_thread();
+			});
+		}
+
+		~LogMmapSink() override
+		{
+			flush();
+
+			running_.store(false, std::memory_order_release);
+			work_word_.fetch_add(1, std::memory_order_release);
+			unpark_threads(work_word_);
+			segment_thread_->join();
+			delete segment_thread_;
+
+			current_.header_->sealed_.store(1, std::memory_order_release);
+			seal(current_, true);
+
+			// The spare was never written to, drop it.
+			if (spare_ready_.load(std::memory_order_acquire))
+			{
+				const std::string spare_name = log_segment_name(base_name_, spare_.header_->index_);
+				munmap(spare_.map_, segment_size_);
+				close(spare_.fd_);
+				unlink(spare_name.c_str());
+			}
+		}
+
+		LogMmapSink() = delete;
+
+		LogMmapSink(const LogMmapSink &) = delete;
+
+		LogMmapSink(const LogMmapSink &&) = delete;
+
+		LogMmapSink &operator=(const LogMmapSink &) = delete;
+
+		LogMmapSink &operator=(const LogMmapSink &&) = delete;
+
+		/// Publishes everything formatted so far to readers and applies the sync policy. No syscalls unless the
+		/// policy is ON_FLUSH or the segment is due for time based rotation.
+		void flush() noexcept
+		{
+			const uint64_t committed = commit();
+			flushes_++;
+
+			if (sync_policy_ == LogSyncPolicy::ON_FLUSH && committed != synced_)
+			{
+				// msync wants a page aligned start.
+				const size_t begin = (LOG_PAGE_SIZE + synced_) & ~(LOG_PAGE_SIZE - 1);
+				msync(current_.map_ + begin, LOG_PAGE_SIZE + committed - begin, MS_ASYNC);
+				synced_ = committed;
+			}
+
+			if (rotate_interval_ns_ && committed && get_ns() - segment_open_ns_ >= rotate_interval_ns_)
+			{
+				rotate();
+			}
+		}
+
+	protected:
+		int_type overflow(int_type ch) override
+		{
+			commit();
+			rotate();
+
+			if (!traits_type::eq_int_type(ch, traits_type::eof()))
+			{
+				*pptr() = traits_type::to_char_type(ch);
+				pbump(1);
+			}
+			return traits_type::not_eof(ch);
+		}
+
+		int sync() override
+		{
+			flush();
+			return 0;
+		}
+	};
+
+	/* Tails the segments written by LogMmapSink from any process. poll() costs one acquire load on the mapped header
+	 * while there is nothing new, syscalls are only made when moving on to the next segment.
+	 */
+	class LogSegmentReader final
+	{
+	private:
+		const std::string base_name_;
+		uint64_t index_;
+		int fd_ = -1;
+		char *map_ = nullptr;
+		size_t map_size_ = 0;
+		uint64_t consumed_ = 0;
+
+		bool open_segment() noexcept
+		{
+			const std::string name = log_segment_name(base_name_, index_);
+			fd_ = open(name.c_str(), O_RDONLY);
+			if (fd_ == -1)
+			{
+				return false;
+			}
+
+			struct stat st {};
+			if (fstat(fd_, &st) == -1 || static_cast<size_t>(st.st_size) < LOG_PAGE_SIZE)
+			{
+				close(fd_);
+				fd_ = -1;
+				return false;
+			}
+
+			map_size_ = st.st_size;
+			void *map = mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd_, 0);
+			if (map == MAP_FAILED)
+			{
+				close(fd_);
+				fd_ = -1;
+				return false;
+			}
+
+			map_ = static_cast<char *>(map);
+			consumed_ = 0;
+			return true;
+		}
+
+		void close_segment() noexcept
+		{
+			munmap(map_, map_size_);
+			close(fd_);
+			map_ = nullptr;
+			fd_ = -1;
+		}
+
+		[[nodiscard]] const LogSegmentHeader *header() const noexcept
+		{
+			return reinterpret_cast<const LogSegmentHeader *>(map_);
+		}
+
+	public:
+		explicit LogSegmentReader(const std::string &base_name, uint64_t first_index = 0) : base_name_(base_name),
+			index_(first_index)
+		{
+		}
+
+		~LogSegmentReader()
+		{
+			if (map_)
+			{
+				close_segment();
+			}
+		}
+
+		LogSegmentReader() = delete;
+
+		LogSegmentReader(const LogSegmentReader &) = delete;
+
+		LogSegmentReader(const LogSegmentReader &&) = delete;
+
+		LogSegmentReader &operator=(const LogSegmentReader &) = delete;
+
+		LogSegmentReader &operator=(const LogSegmentReader &&) = delete;
+
+		/// Hands every byte committed since the last call to f(const char*, size_t). Returns the byte count.
+		template<typename F>
+		size_t poll(F &&f)
+		{
+			size_t total = 0;
+
+			while (map_ || open_segment())
+			{
+				const uint64_t committed = std::min<uint64_t>(header()->committed_.load(std::memory_order_acquire),
+				                                              map_size_ - LOG_PAGE_SIZE);
+				if (committed > consumed_)
+				{
+					f(map_ + LOG_PAGE_SIZE + consumed_, committed - consumed_);
+					total += committed - consumed_;
+					consumed_ = committed;
+				}
+
+				if (!header()->sealed_.load(std::memory_order_acquire) ||
+				    header()->committed_.load(std::memory_order_acquire) != consumed_)
+				{
+					break;
+				}
+
+				close_segment();
+				index_++;
+			}
+
+			return total;
+		}
+	};
+}
+
+#endif //LOWLATENCYFINTECH_LOG_SINK_H
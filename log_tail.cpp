@@ -0,0 +1,41 @@
+//
+// Follows the segments of a Common::Logger using LogSinkType::MMAP and copies them to stdout.
+//
+// Usage: LogTail <log base name> [first segment index]
+//
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+
+#include "log_sink.h"
+
+int main(int argc, char **argv)
+{
+	using namespace Common;
+
+	if (argc < 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " <log base name> [first segment index]\n";
+		return EXIT_FAILURE;
+	}
+
+	LogSegmentReader reader(argv[1], argc > 2 ? std::stoull(argv[2]) : 0);
+
+	while (true)
+	{
+		const size_t n = reader.poll([](const char *data, size_t len)
+		{
+			std::cout.write(data, len);
+		});
+
+		if (!n)
+		{
+			std::cout.flush();
+
+			using namespace std::literals::chrono_literals;
+			std::this_thread::sleep_for(10ms);
+		}
+	}
+}
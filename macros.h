@@ -8,6 +8,13 @@
 #include <string>
 #include <iostream>
 
+// Debug builds keep the cheap consistency checks of the hot path containers, release builds (NDEBUG) compile them out.
+#ifdef NDEBUG
+constexpr bool CHECKED_BUILD = false;
+#else
+constexpr bool CHECKED_BUILD = true;
+#endif
+
 inline void ASSERT(bool cond, const std::string& msg) noexcept
 {
 	if (!cond)
@@ -17,9 +24,25 @@ inline void ASSERT(bool cond, const std::string& msg) noexcept
 	}
 }
 
+// Kept out of line so a passing ASSERT inlines to a compare and a branch.
+[[noreturn, gnu::cold, gnu::noinline]] inline void assert_failed(const char* msg) noexcept
+{
+	std::cerr << msg << '\n';
+	exit(EXIT_FAILURE);
+}
+
+// Overload for literal messages so a passing check does not construct a std::string.
+inline void ASSERT(bool cond, const char* msg) noexcept
+{
+	if (!cond) [[unlikely]]
+	{
+		assert_failed(msg);
+	}
+}
+
 inline void FATAL(const std::string& msg) noexcept
 {
-	std::cerr << "msg" << '\n';
+	std::cerr << msg << '\n';
 	exit(EXIT_FAILURE);
 }
 #endif //LOWLATENCYFINTECH_MACROS_H
@@ -1,15 +1,18 @@
 #include <iostream>
 #include <sstream>
+#include <fstream>
 
 #include "basics.h"
+#include "benchmarks.h"
 #include "RingBuffer.h"
+#include "rolling_window.h"
 #include "mem_pool.h"
 #include "Logger.h"
 
 template <typename T>
 void print_buffer(RingBuffer<T>& r)
 {
-    for (int i = 0; i < r.size(); i++)
+    for (size_t i = 0; i < r.size(); i++)
     {
         std::cout << r[i] << '\n';
     }
@@ -65,11 +68,20 @@ void ring_buffer_ex()
 
 	std::cout << '\n';
 
-	rb.print_top();
-	rb.print_top();
-	rb.print_top();
-	rb.print_top();
-	rb.print_top();
+	while (!rb.empty())
+	{
+		rb.print_top();
+	}
+
+	Common::RollingWindow trades(4);
+	const double prices[] = {100.0, 100.5, 99.75, 101.0, 100.25, 100.5};
+	for (int i = 0; i < 6; i++)
+	{
+		trades.add(i * Common::NANOS_TO_MICROS, prices[i], 10 + i);
+		std::cout << "price: " << prices[i] << " mean: " << trades.mean() << " vwap: " << trades.vwap()
+			<< " variance: " << trades.variance() << " ewma: " << trades.ewma() << " min: " << trades.min()
+			<< " max: " << trades.max() << '\n';
+	}
 }
 
 #include "lock_free_q.h"
@@ -144,6 +156,60 @@ void log_test()
 	console.log("Logging a float: % and a double: %\n", f, d);
 	console.log("Logging a cstr: % \n", cc);
 	console.log("Logging a string % \n", s);
+
+	// Same calls in binary mode, run LogDecoder on the file to get the text back.
+	Logger binary("logging_example.bin", {.mode_ = LogMode::BINARY});
+
+	binary.log("Logging a char: % an int: % and an unsigned: %\n", c, i, u);
+	binary.log("Logging a float: % and a double: %\n", f, d);
+	binary.log("Logging a cstr: % \n", cc);
+	binary.log("Logging a string % \n", s);
+}
+
+// One thread logging round-robin to more loggers than its lane cache holds must keep reusing one lane per logger,
+// or the evictions leak lanes until register_lane asserts and the records of one thread lose their order.
+void log_lane_test()
+{
+	using namespace Common;
+
+	constexpr size_t loggers = LOG_LANE_CACHE_SIZE + 2;
+	constexpr int rounds = 1000;
+
+	{
+		std::vector<std::unique_ptr<Logger>> logs;
+		for (size_t l = 0; l < loggers; l++)
+		{
+			logs.push_back(std::make_unique<Logger>("log_lane_test_" + std::to_string(l) + ".txt"));
+		}
+
+		for (int r = 0; r < rounds; r++)
+		{
+			for (auto &log : logs)
+			{
+				log->log("round %\n", r);
+			}
+		}
+
+		for (size_t l = 0; l < loggers; l++)
+		{
+			ASSERT(logs[l]->stats().lanes_ == 1, "Logger " + std::to_string(l) + " has more than one lane");
+		}
+	}
+
+	for (size_t l = 0; l < loggers; l++)
+	{
+		std::ifstream in("log_lane_test_" + std::to_string(l) + ".txt");
+		std::string line;
+		int expected = 0;
+		while (std::getline(in, line))
+		{
+			ASSERT(line == "round " + std::to_string(expected), "Out of order record: " + line);
+			expected++;
+		}
+		ASSERT(expected == rounds, "Lost records in logger " + std::to_string(l));
+	}
+
+	std::cout << "log_lane_test: " << loggers << " loggers x " << rounds << " rounds from one thread, one lane each\n";
 }
 
 int main()
@@ -154,5 +220,24 @@ int main()
 	//mempool_ex();
 	//LFQ_test();
 	log_test();
+	//log_lane_test();
+
+	//logger_startup_bench();
+	//lfq_pop_bench();
+	//lfq_batch_bench();
+	//mpmc_bench();
+	//broadcast_ring_bench();
+	//mempool_bench();
+	//arena_bench();
+	//concurrent_pool_bench();
+	//mempool_construct_bench();
+	//rolling_window_bench();
+	//order_book_bench();
+	//matching_engine_bench();
+	//lookup_table_bench();
+	//feed_handler_bench();
+	//md_publisher_bench();
+	//tcp_server_bench();
+	//io_uring_bench();
     return 0;
 }
\ No newline at end of file
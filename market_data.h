@@ -0,0 +1,70 @@
+#ifndef LOWLATENCYFINTECH_MARKET_DATA_H
+#define LOWLATENCYFINTECH_MARKET_DATA_H
+
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+#include "time_utils.h"
+#include "lock_free_q.h"
+#include "order_book.h"
+#include "matching_engine.h"
+
+namespace Common
+{
+	/// Largest UDP payload that fits a standard 1500 byte Ethernet frame, so a packet is never IP fragmented.
+	constexpr size_t MD_MAX_PACKET = 1472;
+
+	/* Every market data packet is this header followed by count_ MarketUpdates, in host byte order and layout: the
+	 * publisher and its subscribers are builds of this code on the same kind of machine.
+	 *
+	 * seq_ numbers the packets of a channel from 1 without holes, which is all a subscriber needs to spot a lost or
+	 * repeated packet. send_ts_ is the publisher's clock when the packet was handed to the kernel.
+	 */
+	struct MDPacketHeader
+	{
+		uint64_t seq_ = 0;
+		nanos send_ts_ = 0;
+		uint32_t channel_ = 0;
+		uint32_t count_ = 0;
+	};
+
+	constexpr size_t MD_MAX_UPDATES = (MD_MAX_PACKET - sizeof(MDPacketHeader)) / sizeof(MarketUpdate);
+
+	static_assert(std::is_trivially_copyable_v<MarketUpdate>, "MarketUpdates are copied to and from the wire as is");
+
+	/// A MarketUpdate as handed on by a FeedHandler, with the packet it came in. The three times split a packet's
+	/// latency into publisher to kernel, kernel to our read and read to whoever takes it off the queue.
+	struct MDUpdate
+	{
+		uint32_t channel_ = 0;
+		bool gap_before_ = false; // packets of this channel were lost right before this one
+		uint64_t seq_ = 0;
+		nanos send_ts_ = 0; // publisher's clock
+		nanos recv_ts_ = 0; // kernel receive timestamp, read_ts_ when the handler has them turned off
+		nanos read_ts_ = 0; // recvmmsg() returned the packet
+		MarketUpdate update_;
+	};
+
+	typedef LFQueue<MDUpdate> MDUpdateQueue;
+
+	/// Replays a book change on a copy of the book it came from, keyed by market order id. Trades and the snapshot
+	/// markers change nothing by themselves. False if the copy refused the change: an unknown or duplicate id, or a
+	/// copy sized smaller than the original.
+	inline bool apply_update(OrderBook &book, const MarketUpdate &update) noexcept
+	{
+		switch (update.type_)
+		{
+			case MarketUpdateType::ADD:
+				return book.add(update.order_id_, update.side_, update.price_, update.qty_);
+			case MarketUpdateType::MODIFY:
+				return book.modify(update.order_id_, update.price_, update.qty_);
+			case MarketUpdateType::CANCEL:
+				return book.cancel(update.order_id_);
+			default:
+				return true;
+		}
+	}
+}
+
+#endif //LOWLATENCYFINTECH_MARKET_DATA_H
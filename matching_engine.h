@@ -0,0 +1,439 @@
+#ifndef LOWLATENCYFINTECH_MATCHING_ENGINE_H
+#define LOWLATENCYFINTECH_MATCHING_ENGINE_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+
+#include "macros.h"
+#include "time_utils.h"
+#include "thread_utils.h"
+#include "lock_free_q.h"
+#include "order_book.h"
+#include "flat_tables.h"
+#include "Logger.h"
+
+namespace Common
+{
+	typedef uint32_t ClientId;
+
+	enum class ClientRequestType : uint8_t
+	{
+		INVALID,
+		NEW,
+		CANCEL,
+		MODIFY
+	};
+
+	enum class ClientResponseType : uint8_t
+	{
+		INVALID,
+		ACCEPTED,
+		CANCELED,
+		MODIFIED,
+		FILLED,
+		REJECTED,
+		CANCEL_REJECTED,
+		MODIFY_REJECTED
+	};
+
+	enum class MarketUpdateType : uint8_t
+	{
+		INVALID,
+		ADD,
+		MODIFY,
+		CANCEL,
+		TRADE,
+		SNAPSHOT_START, // snapshot stream only, order_id_ is the last incremental sequence number the snapshot includes
+		SNAPSHOT_END
+	};
+
+	inline const char *request_type_to_string(ClientRequestType type) noexcept
+	{
+		switch (type)
+		{
+			case ClientRequestType::NEW:
+				return "NEW";
+			case ClientRequestType::CANCEL:
+				return "CANCEL";
+			case ClientRequestType::MODIFY:
+				return "MODIFY";
+			case ClientRequestType::INVALID:
+				break;
+		}
+		return "INVALID";
+	}
+
+	/// Orders are named by the client's own order id, which must be below the engine's max_client_orders.
+	struct ClientRequest
+	{
+		ClientRequestType type_ = ClientRequestType::INVALID;
+		Side side_ = Side::BUY;
+		ClientId client_id_ = 0;
+		OrderId client_order_id_ = ORDER_ID_INVALID;
+		Price price_ = PRICE_INVALID;
+		Qty qty_ = 0;
+		nanos ts_ = 0; // stamped by the sender, echoed in every response to the request
+	};
+
+	/// Exactly one of ACCEPTED, CANCELED, MODIFIED or a *_REJECTED acknowledges each request, FILLED responses go to
+	/// both sides of every trade.
+	struct ClientResponse
+	{
+		ClientResponseType type_ = ClientResponseType::INVALID;
+		Side side_ = Side::BUY;
+		ClientId client_id_ = 0;
+		OrderId client_order_id_ = ORDER_ID_INVALID;
+		OrderId market_order_id_ = ORDER_ID_INVALID;
+		Price price_ = PRICE_INVALID;
+		Qty exec_qty_ = 0;
+		Qty leaves_qty_ = 0;
+		nanos request_ts_ = 0;
+	};
+
+	/// Anonymous book changes, enough for a subscriber to rebuild the book by market order id.
+	struct MarketUpdate
+	{
+		MarketUpdateType type_ = MarketUpdateType::INVALID;
+		Side side_ = Side::BUY;
+		OrderId order_id_ = ORDER_ID_INVALID;
+		Price price_ = PRICE_INVALID;
+		Qty qty_ = 0;
+	};
+
+	typedef LFQueue<ClientRequest> ClientRequestQueue;
+	typedef LFQueue<ClientResponse> ClientResponseQueue;
+	typedef LFQueue<MarketUpdate> MarketUpdateQueue;
+
+	struct MatchingEngineConfig
+	{
+		size_t max_orders_ = 1024 * 1024; // resting at once
+		size_t max_levels_ = 4096;
+		ClientId max_clients_ = 64;
+		OrderId max_client_orders_ = 64 * 1024; // client order ids per client
+	};
+
+	/* Price-time priority matching engine for one instrument.
+	 *
+	 * Reads client requests from one LFQueue and writes client responses and market updates to two others, on a
+	 * thread of its own started with start(). A new order first trades against the opposite side best level by best
+	 * level and oldest order first while it crosses, whatever is left rests in the book. A modify that would cross is
+	 * a cancel and a new aggressive order, any other modify goes through OrderBook::modify(). A new order or modify
+	 * at a price the book has no level left for is rejected up front, even one that would have filled completely.
+	 *
+	 * Everything the engine touches is sized in the constructor: the book's pools, a DirectIndex from
+	 * (client, client order id) to market order id, the owner of every market order id and a stack of free market ids
+	 * so they stay dense for the book's direct-indexed lookup. The loop does no allocation and no system calls, the
+	 * Logger only copies arguments into the thread's lane, which the engine thread claims before entering the loop.
+	 */
+	class MatchingEngine final
+	{
+	private:
+		struct OrderOwner
+		{
+			ClientId client_id_ = 0;
+			OrderId client_order_id_ = ORDER_ID_INVALID;
+		};
+
+		const MatchingEngineConfig config_;
+		ClientRequestQueue *requests_;
+		ClientResponseQueue *responses_;
+		MarketUpdateQueue *updates_;
+		Logger &logger_;
+
+		OrderBook book_;
+		DirectIndex<OrderId> client_orders_;
+		std::vector<OrderOwner> owners_;
+		std::vector<OrderId> free_ids_;
+
+		std::atomic<bool> running_ = false;
+		std::thread *thread_ = nullptr;
+
+		OrderId &client_order(ClientId client_id, OrderId client_order_id) noexcept
+		{
+			return client_orders_[client_id * config_.max_client_orders_ + client_order_id];
+		}
+
+		void respond(ClientResponseType type, const ClientRequest &request, OrderId market_order_id, Price price,
+		             Qty exec_qty, Qty leaves_qty) noexcept
+		{
+			*responses_->get_next_write_loc() = {type, request.side_, request.client_id_, request.client_order_id_,
+			                                     market_order_id, price, exec_qty, leaves_qty, request.ts_};
+			responses_->update_write_idx();
+		}
+
+		void publish(MarketUpdateType type, Side side, OrderId order_id, Price price, Qty qty) noexcept
+		{
+			*updates_->get_next_write_loc() = {type, side, order_id, price, qty};
+			updates_->update_write_idx();
+		}
+
+		void release(OrderId market_order_id) noexcept
+		{
+			const OrderOwner &owner = owners_[market_order_id];
+			client_order(owner.client_id_, owner.client_order_id_) = ORDER_ID_INVALID;
+			free_ids_.push_back(market_order_id);
+		}
+
+		/// Trades the aggressor against the best opposite levels while it crosses, returns the quantity left.
+		Qty match(const ClientRequest &request, OrderId market_order_id, Qty qty) noexcept
+		{
+			const Side opposite = request.side_ == Side::BUY ? Side::SELL : Side::BUY;
+
+			while (qty != 0)
+			{
+				const PriceLevel *best = book_.best_level(opposite);
+				if (!best || (request.side_ == Side::BUY ? best->price_ > request.price_ : best->price_ < request.price_))
+				{
+					break;
+				}
+
+				const BookOrder *resting = best->first_;
+				const OrderId resting_id = resting->id_;
+				const Price price = resting->price_;
+				const Qty resting_qty = resting->qty_;
+				const Qty fill = std::min(qty, resting_qty);
+				const OrderOwner owner = owners_[resting_id];
+
+				qty -= fill;
+				book_.execute(resting_id, fill);
+
+				respond(ClientResponseType::FILLED, request, market_order_id, price, fill, qty);
+				*responses_->get_next_write_loc() = {ClientResponseType::FILLED, opposite, owner.client_id_,
+				                                     owner.client_order_id_, resting_id, price, fill,
+				                                     resting_qty - fill, request.ts_};
+				responses_->update_write_idx();
+
+				publish(MarketUpdateType::TRADE, request.side_, ORDER_ID_INVALID, price, fill);
+				if (fill == resting_qty)
+				{
+					publish(MarketUpdateType::CANCEL, opposite, resting_id, price, 0);
+					release(resting_id);
+				}
+				else
+				{
+					publish(MarketUpdateType::MODIFY, opposite, resting_id, price, resting_qty - fill);
+				}
+			}
+
+			return qty;
+		}
+
+		void add(const ClientRequest &request) noexcept
+		{
+			OrderId &slot = client_order(request.client_id_, request.client_order_id_);
+			if (slot != ORDER_ID_INVALID || free_ids_.empty() || request.qty_ == 0) [[unlikely]]
+			{
+				respond(ClientResponseType::REJECTED, request, ORDER_ID_INVALID, request.price_, 0, 0);
+				return;
+			}
+			if (!book_.can_rest(request.side_, request.price_)) [[unlikely]]
+			{
+				logger_.log("MatchingEngine rejected NEW from client % order %: no free level for price %\n",
+				            request.client_id_, request.client_order_id_, request.price_);
+				respond(ClientResponseType::REJECTED, request, ORDER_ID_INVALID, request.price_, 0, 0);
+				return;
+			}
+
+			const OrderId market_order_id = free_ids_.back();
+			free_ids_.pop_back();
+
+			respond(ClientResponseType::ACCEPTED, request, market_order_id, request.price_, 0, request.qty_);
+
+			const Qty leaves = match(request, market_order_id, request.qty_);
+			if (leaves == 0)
+			{
+				free_ids_.push_back(market_order_id);
+				return;
+			}
+
+			slot = market_order_id;
+			owners_[market_order_id] = {request.client_id_, request.client_order_id_};
+			book_.add(market_order_id, request.side_, request.price_, leaves);
+			publish(MarketUpdateType::ADD, request.side_, market_order_id, request.price_, leaves);
+		}
+
+		void cancel(const ClientRequest &request) noexcept
+		{
+			const OrderId market_order_id = client_order(request.client_id_, request.client_order_id_);
+			const BookOrder *order = market_order_id != ORDER_ID_INVALID ? book_.order(market_order_id) : nullptr;
+			if (!order) [[unlikely]]
+			{
+				respond(ClientResponseType::CANCEL_REJECTED, request, ORDER_ID_INVALID, request.price_, 0, 0);
+				return;
+			}
+
+			const Side side = order->side_;
+			const Price price = order->price_;
+			book_.cancel(market_order_id);
+			release(market_order_id);
+
+			respond(ClientResponseType::CANCELED, request, market_order_id, price, 0, 0);
+			publish(MarketUpdateType::CANCEL, side, market_order_id, price, 0);
+		}
+
+		void modify(const ClientRequest &request) noexcept
+		{
+			const OrderId market_order_id = client_order(request.client_id_, request.client_order_id_);
+			const BookOrder *order = market_order_id != ORDER_ID_INVALID ? book_.order(market_order_id) : nullptr;
+			if (!order || order->side_ != request.side_ || request.qty_ == 0) [[unlikely]]
+			{
+				respond(ClientResponseType::MODIFY_REJECTED, request, ORDER_ID_INVALID, request.price_, 0, 0);
+				return;
+			}
+
+			// Checked before either path touches the order, so a rejected modify leaves it resting as it was.
+			if (!book_.can_rest(request.side_, request.price_)) [[unlikely]]
+			{
+				logger_.log("MatchingEngine rejected MODIFY from client % order %: no free level for price %\n",
+				            request.client_id_, request.client_order_id_, request.price_);
+				respond(ClientResponseType::MODIFY_REJECTED, request, ORDER_ID_INVALID, request.price_, 0, 0);
+				return;
+			}
+
+			const PriceLevel *opposite = book_.best_level(request.side_ == Side::BUY ? Side::SELL : Side::BUY);
+			const bool crosses = opposite && (request.side_ == Side::BUY ? opposite->price_ <= request.price_
+			                                                             : opposite->price_ >= request.price_);
+			if (crosses)
+			{
+				// Cancel and replace with an aggressive order under the same client order id.
+				const Price price = order->price_;
+				book_.cancel(market_order_id);
+				release(market_order_id);
+				publish(MarketUpdateType::CANCEL, request.side_, market_order_id, price, 0);
+				add(request);
+				return;
+			}
+
+			book_.modify(market_order_id, request.price_, request.qty_);
+			respond(ClientResponseType::MODIFIED, request, market_order_id, request.price_, 0, request.qty_);
+			publish(MarketUpdateType::MODIFY, request.side_, market_order_id, request.price_, request.qty_);
+		}
+
+		void run() noexcept
+		{
+			logger_.log("MatchingEngine started, max orders: % max clients: %\n", config_.max_orders_,
+			            config_.max_clients_);
+
+			while (running_.load(std::memory_order_acquire))
+			{
+				if (poll() == 0)
+				{
+					cpu_relax();
+				}
+			}
+
+			logger_.log("MatchingEngine stopped\n");
+		}
+
+	public:
+		MatchingEngine(ClientRequestQueue *requests, ClientResponseQueue *responses, MarketUpdateQueue *updates,
+		               Logger &logger, const MatchingEngineConfig &config = {}) : config_(config),
+			requests_(requests), responses_(responses), updates_(updates), logger_(logger),
+			book_(config.max_orders_, config.max_levels_, config.max_orders_),
+			client_orders_(config.max_clients_ * config.max_client_orders_, ORDER_ID_INVALID),
+			owners_(config.max_orders_)
+		{
+			// Lowest ids on top.
+			free_ids_.reserve(config_.max_orders_);
+			for (size_t i = config_.max_orders_; i > 0; i--)
+			{
+				free_ids_.push_back(i - 1);
+			}
+		}
+
+		~MatchingEngine()
+		{
+			stop();
+		}
+
+		MatchingEngine() = delete;
+		MatchingEngine(const MatchingEngine&) = delete;
+		MatchingEngine(const MatchingEngine&&) = delete;
+		MatchingEngine& operator=(const MatchingEngine&) = delete;
+		MatchingEngine& operator=(const MatchingEngine&&) = delete;
+
+		/// Runs the engine loop on its own thread pinned to core_id (-1 leaves it unpinned).
+		void start(int core_id)
+		{
+			running_ = true;
+			thread_ = launch_thread(core_id, "Exchange/MatchingEngine", [this]()
+			{
+				run();
+			});
+			ASSERT(thread_ != nullptr, "Failed to start matching engine thread");
+		}
+
+		void stop()
+		{
+			if (!thread_)
+			{
+				return;
+			}
+
+			running_ = false;
+			thread_->join();
+			delete thread_;
+			thread_ = nullptr;
+		}
+
+		/// Processes every request waiting in the queue, returns how many. Called by the engine thread, or directly
+		/// when the engine is driven inline without start().
+		size_t poll() noexcept
+		{
+			size_t processed = 0;
+
+			for (const ClientRequest *request = requests_->get_next_to_read(); request;
+			     request = requests_->get_next_to_read())
+			{
+				process(*request);
+				requests_->update_read_idx();
+				processed++;
+			}
+
+			return processed;
+		}
+
+		void process(const ClientRequest &request) noexcept
+		{
+			if (request.client_id_ >= config_.max_clients_ || request.client_order_id_ >= config_.max_client_orders_)
+				[[unlikely]]
+			{
+				logger_.log("MatchingEngine rejected % from client % order %: id out of range\n",
+				            request_type_to_string(request.type_), request.client_id_, request.client_order_id_);
+				respond(ClientResponseType::REJECTED, request, ORDER_ID_INVALID, request.price_, 0, 0);
+				return;
+			}
+
+			logger_.log("MatchingEngine % client: % order: % side: % price: % qty: %\n",
+			            request_type_to_string(request.type_), request.client_id_, request.client_order_id_,
+			            side_to_string(request.side_), request.price_, request.qty_);
+
+			switch (request.type_)
+			{
+				case ClientRequestType::NEW:
+					add(request);
+					break;
+				case ClientRequestType::CANCEL:
+					cancel(request);
+					break;
+				case ClientRequestType::MODIFY:
+					modify(request);
+					break;
+				case ClientRequestType::INVALID:
+					respond(ClientResponseType::REJECTED, request, ORDER_ID_INVALID, request.price_, 0, 0);
+					break;
+			}
+		}
+
+		const OrderBook &book() const noexcept
+		{
+			return book_;
+		}
+	};
+}
+
+#endif //LOWLATENCYFINTECH_MATCHING_ENGINE_H
@@ -0,0 +1,369 @@
+#ifndef LOWLATENCYFINTECH_MD_PUBLISHER_H
+#define LOWLATENCYFINTECH_MD_PUBLISHER_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <sys/uio.h>
+
+#include "macros.h"
+#include "mem_utils.h"
+#include "time_utils.h"
+#include "thread_utils.h"
+#include "socket_utils.h"
+#include "order_book.h"
+#include "matching_engine.h"
+#include "market_data.h"
+#include "Logger.h"
+
+namespace Common
+{
+	// sendmmsg() calls in a row that may find the socket buffer full before the rest of a batch is dropped.
+	constexpr unsigned int MD_SEND_RETRIES = 64;
+
+	/* Sending side of one multicast channel: a connected UDP socket, the channel's sequence numbers and batch
+	 * preallocated packet buffers.
+	 *
+	 * add() appends updates to the open packet and closes it once MD_MAX_UPDATES fit no more, closed packets wait
+	 * until all batch buffers are used or flush() is called, then leave with one sendmmsg(). Sequence numbers are
+	 * given out as packets close, the send time is stamped on the whole batch right before it goes.
+	 */
+	class MDPacketSender final
+	{
+	private:
+		const uint32_t channel_;
+		const unsigned int batch_;
+		Logger &logger_;
+		int fd_ = -1;
+
+		Arena packets_;
+		std::vector<iovec> iovecs_;
+		std::vector<mmsghdr> msgs_;
+
+		uint64_t seq_ = 0; // of the last packet closed
+		unsigned int closed_ = 0; // packets waiting for send()
+		uint32_t count_ = 0; // updates in the open packet
+		uint64_t send_calls_ = 0;
+		uint64_t dropped_packets_ = 0;
+
+		uint8_t *packet(size_t i) const noexcept
+		{
+			return static_cast<uint8_t *>(packets_.data()) + i * MD_MAX_PACKET;
+		}
+
+		void close_packet() noexcept
+		{
+			const MDPacketHeader header {++seq_, 0, channel_, count_};
+			std::memcpy(packet(closed_), &header, sizeof(header));
+			iovecs_[closed_].iov_len = sizeof(header) + count_ * sizeof(MarketUpdate);
+
+			count_ = 0;
+			if (++closed_ == batch_)
+			{
+				send();
+			}
+		}
+
+		void send() noexcept
+		{
+			const nanos send_ts = get_ns();
+			for (unsigned int i = 0; i < closed_; i++)
+			{
+				std::memcpy(packet(i) + offsetof(MDPacketHeader, send_ts_), &send_ts, sizeof(send_ts));
+			}
+
+			// A full socket buffer usually only means the kernel is briefly behind, so retry a while before turning it
+			// into a gap. One that stays full must not stall the publisher, subscribers recover from the snapshots.
+			unsigned int retries = 0;
+			for (unsigned int sent = 0; sent < closed_;)
+			{
+				const int n = send_mmsg(fd_, msgs_.data() + sent, closed_ - sent);
+				if (n > 0)
+				{
+					sent += static_cast<unsigned int>(n);
+					send_calls_++;
+					retries = 0;
+				}
+				else if ((!would_block() && errno != EAGAIN && errno != ENOBUFS) || ++retries == MD_SEND_RETRIES)
+					[[unlikely]]
+				{
+					dropped_packets_ += closed_ - sent;
+					logger_.log("MDPacketSender channel % sendmmsg() failed errno:%, % packets dropped, % in total\n",
+					            channel_, strerror(errno), closed_ - sent, dropped_packets_);
+					break;
+				}
+			}
+
+			closed_ = 0;
+		}
+
+	public:
+		MDPacketSender(Logger &logger, const std::string &ip, const std::string &iface, int port, uint32_t channel,
+		               unsigned int batch, int ttl, const ArenaConfig &arena = {}) : channel_(channel), batch_(batch),
+			logger_(logger), packets_(batch * MD_MAX_PACKET, arena), iovecs_(batch), msgs_(batch)
+		{
+			ASSERT(batch_ != 0, "MDPacketSender needs at least one packet buffer");
+
+			fd_ = create_socket(logger_, ip, iface, port, true, false, false, ttl, false);
+			ASSERT(fd_ != -1, "MDPacketSender failed to open " + ip + " on " + iface);
+
+			for (size_t i = 0; i < batch_; i++)
+			{
+				iovecs_[i] = {packet(i), 0};
+				msgs_[i] = {};
+				msgs_[i].msg_hdr.msg_iov = &iovecs_[i];
+				msgs_[i].msg_hdr.msg_iovlen = 1;
+			}
+		}
+
+		~MDPacketSender()
+		{
+			if (fd_ != -1)
+			{
+				close(fd_);
+			}
+		}
+
+		MDPacketSender() = delete;
+		MDPacketSender(const MDPacketSender&) = delete;
+		MDPacketSender(const MDPacketSender&&) = delete;
+		MDPacketSender& operator=(const MDPacketSender&) = delete;
+		MDPacketSender& operator=(const MDPacketSender&&) = delete;
+
+		void add(const MarketUpdate &update) noexcept
+		{
+			std::memcpy(packet(closed_) + sizeof(MDPacketHeader) + count_ * sizeof(MarketUpdate), &update,
+			            sizeof(update));
+			if (++count_ == MD_MAX_UPDATES)
+			{
+				close_packet();
+			}
+		}
+
+		/// Closes the open packet and sends everything waiting.
+		void flush() noexcept
+		{
+			if (count_ != 0)
+			{
+				close_packet();
+			}
+			if (closed_ != 0)
+			{
+				send();
+			}
+		}
+
+		/// Sequence number of the last packet closed, every packet up to it has been sent after flush().
+		uint64_t seq() const noexcept
+		{
+			return seq_;
+		}
+
+		uint64_t send_calls() const noexcept
+		{
+			return send_calls_;
+		}
+
+		/// Packets given up on after a send error or MD_SEND_RETRIES calls into a full socket buffer.
+		uint64_t dropped_packets() const noexcept
+		{
+			return dropped_packets_;
+		}
+	};
+
+	struct MDPublisherConfig
+	{
+		unsigned int batch_ = 32; // packets per sendmmsg()
+		uint32_t incremental_channel_ = 0;
+		uint32_t snapshot_channel_ = 1;
+		nanos snapshot_interval_ = NANOS_TO_SECS;
+		int ttl_ = 1;
+		ArenaConfig arena_ = {}; // for the packet buffers
+	};
+
+	struct MDPublisherStats
+	{
+		uint64_t updates_ = 0;
+		uint64_t snapshots_ = 0;
+		uint64_t snapshot_updates_ = 0;
+		uint64_t refused_updates_ = 0; // the book copy could not apply them, so snapshots miss those orders
+	};
+
+	/* Publishes a MatchingEngine's market updates on two multicast groups.
+	 *
+	 * The incremental group carries every update in order, coalesced into as few packets as fit: poll() takes
+	 * everything waiting in the queue, packs it MD_MAX_UPDATES to a packet and sends the packets batch_ at a time
+	 * with sendmmsg(), flushing the last partial packet as soon as the queue is empty so nothing waits for more
+	 * traffic. Packets are sequenced per channel so subscribers see any loss.
+	 *
+	 * The updates are also applied to a book of its own, sized from the engine's config, which is sent in full on the
+	 * snapshot group every snapshot_interval_: SNAPSHOT_START, one ADD per resting order from the best level down and
+	 * oldest first, then SNAPSHOT_END. Both markers carry, in order_id_, the last incremental sequence number the
+	 * snapshot includes. A late joiner (or a subscriber that saw a gap) clears its book on SNAPSHOT_START, applies the
+	 * ADDs and after SNAPSHOT_END continues with the incremental packets after that number, without replaying anything
+	 * older. Snapshots are taken between two incremental batches on the publishing thread, so one is always consistent
+	 * with a packet boundary, at the cost of delaying incrementals while it is sent.
+	 */
+	class MarketDataPublisher final
+	{
+	private:
+		const MDPublisherConfig config_;
+		MarketUpdateQueue *updates_;
+		Logger &logger_;
+
+		MDPacketSender incremental_;
+		MDPacketSender snapshot_;
+		OrderBook book_;
+
+		nanos next_snapshot_ = 0;
+		MDPublisherStats stats_;
+
+		std::atomic<bool> running_ = false;
+		std::thread *thread_ = nullptr;
+
+		void run() noexcept
+		{
+			logger_.log("MarketDataPublisher started, batch: % snapshot interval: %ns\n", config_.batch_,
+			            config_.snapshot_interval_);
+
+			while (running_.load(std::memory_order_acquire))
+			{
+				if (poll() == 0)
+				{
+					cpu_relax();
+				}
+			}
+
+			logger_.log("MarketDataPublisher stopped, updates: % incremental packets: % snapshots: %\n",
+			            stats_.updates_, incremental_.seq(), stats_.snapshots_);
+		}
+
+	public:
+		MarketDataPublisher(MarketUpdateQueue *updates, const MatchingEngineConfig &engine, Logger &logger,
+		                    const std::string &iface, const std::string &incremental_ip, int incremental_port,
+		                    const std::string &snapshot_ip, int snapshot_port, const MDPublisherConfig &config = {}) :
+			config_(config),
+			updates_(updates), logger_(logger),
+			incremental_(logger, incremental_ip, iface, incremental_port, config.incremental_channel_, config.batch_,
+			             config.ttl_, config.arena_),
+			snapshot_(logger, snapshot_ip, iface, snapshot_port, config.snapshot_channel_, config.batch_, config.ttl_,
+			          config.arena_),
+			book_(engine.max_orders_, engine.max_levels_, engine.max_orders_)
+		{
+		}
+
+		~MarketDataPublisher()
+		{
+			stop();
+		}
+
+		MarketDataPublisher() = delete;
+		MarketDataPublisher(const MarketDataPublisher&) = delete;
+		MarketDataPublisher(const MarketDataPublisher&&) = delete;
+		MarketDataPublisher& operator=(const MarketDataPublisher&) = delete;
+		MarketDataPublisher& operator=(const MarketDataPublisher&&) = delete;
+
+		/// Runs the publishing loop on its own thread pinned to core_id (-1 leaves it unpinned).
+		void start(int core_id)
+		{
+			running_ = true;
+			thread_ = launch_thread(core_id, "Exchange/MarketDataPublisher", [this]()
+			{
+				run();
+			});
+			ASSERT(thread_ != nullptr, "Failed to start market data publisher thread");
+		}
+
+		void stop()
+		{
+			if (!thread_)
+			{
+				return;
+			}
+
+			running_ = false;
+			thread_->join();
+			delete thread_;
+			thread_ = nullptr;
+		}
+
+		/// Sends every update waiting in the queue and a snapshot when one is due, returns how many updates.
+		size_t poll() noexcept
+		{
+			const LFQSpans<const MarketUpdate> ready = updates_->get_all_to_read();
+			for (size_t i = 0; i < ready.size(); i++)
+			{
+				incremental_.add(ready[i]);
+				if (!apply_update(book_, ready[i])) [[unlikely]]
+				{
+					stats_.refused_updates_++;
+					logger_.log("MarketDataPublisher book refused update type:% order:% price:%, % refused in total\n",
+					            static_cast<int>(ready[i].type_), ready[i].order_id_, ready[i].price_,
+					            stats_.refused_updates_);
+				}
+			}
+			updates_->update_read_idx(ready.size());
+			incremental_.flush();
+			stats_.updates_ += ready.size();
+
+			if (get_ns() >= next_snapshot_) [[unlikely]]
+			{
+				publish_snapshot();
+			}
+
+			return ready.size();
+		}
+
+		/// Sends the whole book on the snapshot group now, as of the last incremental packet sent.
+		void publish_snapshot() noexcept
+		{
+			const OrderId seq = incremental_.seq();
+			size_t orders = 0;
+
+			snapshot_.add({MarketUpdateType::SNAPSHOT_START, Side::BUY, seq, PRICE_INVALID, 0});
+			for (const Side side : {Side::BUY, Side::SELL})
+			{
+				for (const PriceLevel *level = book_.best_level(side); level; level = level->worse_)
+				{
+					for (const BookOrder *order = level->first_; order; order = order->next_)
+					{
+						snapshot_.add({MarketUpdateType::ADD, side, order->id_, order->price_, order->qty_});
+						orders++;
+					}
+				}
+			}
+			snapshot_.add({MarketUpdateType::SNAPSHOT_END, Side::BUY, seq, PRICE_INVALID, 0});
+			snapshot_.flush();
+
+			stats_.snapshots_++;
+			stats_.snapshot_updates_ += orders + 2;
+			next_snapshot_ = get_ns() + config_.snapshot_interval_;
+		}
+
+		const MDPublisherStats &stats() const noexcept
+		{
+			return stats_;
+		}
+
+		const MDPacketSender &incremental() const noexcept
+		{
+			return incremental_;
+		}
+
+		const MDPacketSender &snapshot() const noexcept
+		{
+			return snapshot_;
+		}
+
+		const OrderBook &book() const noexcept
+		{
+			return book_;
+		}
+	};
+}
+
+#endif //LOWLATENCYFINTECH_MD_PUBLISHER_H
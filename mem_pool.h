@@ -7,47 +7,69 @@
 
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <utility>
+#include <type_traits>
 #include "macros.h"
+#include "mem_utils.h"
 
+/* Fixed capacity object pool. Free blocks are tracked on a stack of indices, so allocate() pops and deallocate()
+ * pushes in O(1) however fragmented the pool is. The bookkeeping lives apart from the objects: the store is just
+ * T's back to back and the in-use flags are a separate byte array, so neither pads nor pollutes the objects' cache
+ * lines.
+ *
+ * The store is raw memory: nothing is constructed up front, allocate() constructs the object in place from perfectly
+ * forwarded arguments and deallocate() runs its destructor, so T needs neither a default nor a copy constructor and
+ * move-only members are fine.
+ *
+ * The store is an Arena, so a pool can sit on huge pages, be bound to the trading thread's NUMA node and be locked and
+ * faulted in at startup:
+ *
+ *     MemPool<Order> orders(1'000'000, {.huge_pages_ = Common::HugePages::EXPLICIT, .numa_node_ = 0,
+ *                                       .lock_ = true, .prefault_ = true});
+ */
 template<typename T>
 class MemPool final
 {
 private:
-	struct ObjectBlock
-	{
-		T obj_;
-		bool is_free_ = true;
-	};
+	const size_t capacity_;
+	Common::Arena arena_;
+	T *store_ = nullptr;
+
+	// Stack of free indices, the top is free_[free_count_ - 1].
+	std::vector<uint32_t> free_;
+	size_t free_count_ = 0;
 
-	std::vector<ObjectBlock> store_;
-	size_t next_free_idx_ = 0;
+	std::vector<uint8_t> in_use_;
 
-	void update_next_free_idx() noexcept
+public:
+	// Reserves the storage, objects only exist between allocate() and deallocate().
+	explicit MemPool(size_t num_elements, const Common::ArenaConfig &arena = {}) : capacity_(num_elements),
+		arena_(num_elements * sizeof(T), arena), store_(static_cast<T *>(arena_.data())), free_(num_elements),
+		free_count_(num_elements), in_use_(num_elements, 0)
 	{
-		const size_t initial_free_idx = next_free_idx_;
+		ASSERT(num_elements <= UINT32_MAX, "Memory Pool too large: " + std::to_string(num_elements));
 
-		while (!store_[next_free_idx_].is_free_)
+		// Lowest indices on top so a fresh pool hands out blocks in address order.
+		for (size_t i = 0; i < num_elements; i++)
 		{
-			next_free_idx_++;
-
-			if (next_free_idx_ == store_.size()) [[unlikely]]
-			{
-				next_free_idx_ = 0;
-			}
+			free_[i] = static_cast<uint32_t>(num_elements - 1 - i);
+		}
+	}
 
-			if (initial_free_idx == next_free_idx_) [[unlikely]]
+	~MemPool()
+	{
+		if constexpr (!std::is_trivially_destructible_v<T>)
+		{
+			for (size_t i = 0; i < capacity_; i++)
 			{
-				ASSERT(initial_free_idx != next_free_idx_, "Memory Pool out of Memory");
+				if (in_use_[i])
+				{
+					store_[i].~T();
+				}
 			}
 		}
 	}
-public:
-	//Preallocate the array
-	explicit MemPool(size_t num_elements) : store_(num_elements, {T(), true})
-	{
-		ASSERT(reinterpret_cast<const ObjectBlock*>(&(store_[0].obj_)) == &(store_[0]),
-			"T object should be first member of ObjectBlock.");
-	}
 
 	MemPool() = delete;
 	MemPool(const MemPool&) = delete;
@@ -55,29 +77,44 @@ public:
 	MemPool& operator=(const MemPool&) = delete;
 	MemPool& operator=(const MemPool&&) = delete;
 
+	/// Constructs a T in a free block from args, forwarded as given.
 	template<typename... Args>
-	T* allocate(Args... args) noexcept
+	T* allocate(Args&&... args) noexcept
 	{
-		//Captures the underlying type of the expression store_[next_free_idx_] and removes any ref qualifiers from it.
-		using BlockType = typename std::remove_reference<decltype(store_[next_free_idx_])>::type;
-
-		BlockType* obj_block = &(store_[next_free_idx_]);
-		ASSERT(obj_block->is_free_, "Expected free ObjectBlock at index:" + std::to_string(next_free_idx_));
-		T* ret = &(obj_block->obj_);
-		ret = new(ret) T(args...); // placement new
-		obj_block->is_free_ = false;
+		ASSERT(free_count_ != 0, "Memory Pool out of Memory");
 
-		update_next_free_idx();
+		const uint32_t idx = free_[--free_count_];
+		if (in_use_[idx]) [[unlikely]]
+		{
+			FATAL("Expected free ObjectBlock at index:" + std::to_string(idx));
+		}
+		in_use_[idx] = 1;
 
-		return ret;
+		return new(&store_[idx]) T(std::forward<Args>(args)...);
 	}
 
+	/// Destroys the object and returns its block.
 	void deallocate(const T* elem) noexcept
 	{
-		const auto elem_index = (reinterpret_cast<const ObjectBlock*>(elem) - &store_[0]);
-		ASSERT(elem_index >= 0 && static_cast<size_t>(elem_index) < store_.size(), "Element being deallocated does not belong in this memory pool");
-		ASSERT(!store_[elem_index].is_free_, "Expected in-use ObjectBlock at idx: " + std::to_string(elem_index));
-		store_[elem_index].is_free_ = true;
+		const auto elem_index = elem - store_;
+		ASSERT(elem_index >= 0 && static_cast<size_t>(elem_index) < capacity_, "Element being deallocated does not belong in this memory pool");
+		if (!in_use_[elem_index]) [[unlikely]]
+		{
+			FATAL("Expected in-use ObjectBlock at idx: " + std::to_string(elem_index));
+		}
+		elem->~T();
+		in_use_[elem_index] = 0;
+		free_[free_count_++] = static_cast<uint32_t>(elem_index);
+	}
+
+	size_t capacity() const noexcept
+	{
+		return capacity_;
+	}
+
+	size_t free_count() const noexcept
+	{
+		return free_count_;
 	}
 };
 
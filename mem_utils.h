@@ -0,0 +1,259 @@
+#ifndef LOWLATENCYFINTECH_MEM_UTILS_H
+#define LOWLATENCYFINTECH_MEM_UTILS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <type_traits>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "macros.h"
+
+namespace Common
+{
+	constexpr size_t CACHE_LINE_SIZE = 64;
+	constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+	/// Reserves bytes of anonymous, zero filled memory. Nothing is committed up front: the kernel backs each page on
+	/// first touch, and MAP_NORESERVE keeps large reservations out of the overcommit accounting. huge_pages asks for
+	/// transparent huge pages so the touched part is backed by 2MB pages where the kernel allows it.
+	inline void *reserve_memory(size_t bytes, bool huge_pages = false) noexcept
+	{
+		int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+		flags |= MAP_NORESERVE;
+#endif
+
+		void *mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+		ASSERT(mem != MAP_FAILED, "mmap() failed to reserve " + std::to_string(bytes) + " bytes");
+
+#ifdef MADV_HUGEPAGE
+		if (huge_pages)
+		{
+			madvise(mem, bytes, MADV_HUGEPAGE);
+		}
+#else
+		(void) huge_pages;
+#endif
+
+		return mem;
+	}
+
+	inline void release_memory(void *mem, size_t bytes) noexcept
+	{
+		munmap(mem, bytes);
+	}
+
+	enum class HugePages : uint8_t
+	{
+		NONE,
+		TRANSPARENT, // MADV_HUGEPAGE on a 2MB aligned mapping, the kernel promotes pages when it can
+		EXPLICIT // MAP_HUGETLB from the reserved pool (vm.nr_hugepages), TRANSPARENT when the pool is short
+	};
+
+	struct ArenaConfig
+	{
+		HugePages huge_pages_ = HugePages::NONE;
+		int numa_node_ = -1; // bind the pages to this node, -1 leaves placement to first touch
+		bool lock_ = false; // mlock so the pages are never swapped out, needs RLIMIT_MEMLOCK headroom
+		bool prefault_ = false; // commit every page in the constructor instead of on first touch
+	};
+
+	/* One anonymous mapping set up for the hot path: backed by huge pages, placed on a NUMA node, locked and faulted
+	 * in before trading starts so none of that happens on the first orders. With the defaults it is the same lazily
+	 * committed reservation as reserve_memory().
+	 *
+	 * Asking for huge pages never fails: EXPLICIT falls back to TRANSPARENT when the hugetlb pool can not cover the
+	 * mapping, and TRANSPARENT only advises the kernel. A node that can not be bound to or memory that can not be
+	 * locked is fatal, since those are configuration errors better found at startup.
+	 */
+	class Arena final
+	{
+	private:
+		void *mem_ = nullptr;
+		size_t bytes_ = 0;
+		HugePages huge_pages_ = HugePages::NONE;
+
+		static size_t round_up(size_t bytes, size_t to) noexcept
+		{
+			return (bytes + to - 1) / to * to;
+		}
+
+		/// THP can only back 2MB aligned ranges, so over-reserve by a huge page and trim the ends to alignment.
+		void map_aligned(int flags) noexcept
+		{
+			const size_t reserved = bytes_ + HUGE_PAGE_SIZE;
+			void *mem = mmap(nullptr, reserved, PROT_READ | PROT_WRITE, flags, -1, 0);
+			ASSERT(mem != MAP_FAILED, "mmap() failed to reserve " + std::to_string(reserved) + " bytes");
+
+			const auto begin = reinterpret_cast<uintptr_t>(mem);
+			const uintptr_t aligned = round_up(begin, HUGE_PAGE_SIZE);
+			if (aligned != begin)
+			{
+				munmap(mem, aligned - begin);
+			}
+			if (aligned + bytes_ != begin + reserved)
+			{
+				munmap(reinterpret_cast<void *>(aligned + bytes_), begin + reserved - aligned - bytes_);
+			}
+
+			mem_ = reinterpret_cast<void *>(aligned);
+		}
+
+		void bind(int node) noexcept
+		{
+#if defined(__linux__) && defined(SYS_mbind)
+			// Raw syscall so there is no libnuma dependency. MPOL_BIND = 2, MPOL_MF_STRICT | MPOL_MF_MOVE = 3.
+			constexpr int mpol_bind = 2;
+			constexpr unsigned mpol_mf_strict_move = 3;
+			constexpr size_t mask_bits = 8 * sizeof(unsigned long);
+
+			ASSERT(node >= 0 && static_cast<size_t>(node) < 16 * mask_bits,
+			       "NUMA node out of range: " + std::to_string(node));
+
+			unsigned long node_mask[16] = {};
+			node_mask[node / mask_bits] = 1UL << (node % mask_bits);
+
+			const long ret = syscall(SYS_mbind, mem_, bytes_, mpol_bind, node_mask, 16 * mask_bits + 1,
+			                         mpol_mf_strict_move);
+			ASSERT(ret == 0, "mbind() to NUMA node " + std::to_string(node) + " failed: " + std::strerror(errno));
+#else
+			FATAL("NUMA binding is not supported on this platform, requested node: " + std::to_string(node));
+#endif
+		}
+
+		void prefault() noexcept
+		{
+#ifdef MADV_POPULATE_WRITE
+			if (madvise(mem_, bytes_, MADV_POPULATE_WRITE) == 0)
+			{
+				return;
+			}
+#endif
+			// Writing a zero into zero filled memory commits the page without changing it.
+			const size_t page = huge_pages_ == HugePages::EXPLICIT ? HUGE_PAGE_SIZE : static_cast<size_t>(getpagesize());
+			volatile char *bytes = static_cast<volatile char *>(mem_);
+			for (size_t i = 0; i < bytes_; i += page)
+			{
+				bytes[i] = 0;
+			}
+		}
+
+	public:
+		explicit Arena(size_t bytes, const ArenaConfig &config = {}) noexcept : huge_pages_(config.huge_pages_)
+		{
+			int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+			// Memory that is going to be committed right away should count against overcommit like any other.
+			if (!config.lock_ && !config.prefault_)
+			{
+				flags |= MAP_NORESERVE;
+			}
+#endif
+
+			// mmap() rejects empty mappings, an empty pool or queue still gets one page.
+			if (huge_pages_ != HugePages::NONE)
+			{
+				bytes_ = round_up(std::max<size_t>(bytes, 1), HUGE_PAGE_SIZE);
+			}
+			else
+			{
+				bytes_ = round_up(std::max<size_t>(bytes, 1), static_cast<size_t>(getpagesize()));
+			}
+
+#ifdef MAP_HUGETLB
+			if (huge_pages_ == HugePages::EXPLICIT)
+			{
+				// Without MAP_NORESERVE a short pool fails here rather than with SIGBUS on first touch.
+				mem_ = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+				if (mem_ == MAP_FAILED)
+				{
+					mem_ = nullptr;
+					huge_pages_ = HugePages::TRANSPARENT;
+				}
+			}
+#else
+			if (huge_pages_ == HugePages::EXPLICIT)
+			{
+				huge_pages_ = HugePages::TRANSPARENT;
+			}
+#endif
+
+			if (huge_pages_ == HugePages::TRANSPARENT)
+			{
+				map_aligned(flags);
+#ifdef MADV_HUGEPAGE
+				madvise(mem_, bytes_, MADV_HUGEPAGE);
+#endif
+			}
+			else if (!mem_)
+			{
+				mem_ = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, flags, -1, 0);
+				ASSERT(mem_ != MAP_FAILED, "mmap() failed to reserve " + std::to_string(bytes_) + " bytes");
+			}
+
+			// Bind before anything touches the pages, already placed pages would have to migrate.
+			if (config.numa_node_ >= 0)
+			{
+				bind(config.numa_node_);
+			}
+
+			if (config.lock_)
+			{
+				if (mlock(mem_, bytes_) != 0)
+				{
+					FATAL("mlock() of " + std::to_string(bytes_) + " bytes failed: " + std::strerror(errno) +
+					      " (check RLIMIT_MEMLOCK)");
+				}
+			}
+
+			if (config.prefault_ && !config.lock_)
+			{
+				prefault();
+			}
+		}
+
+		~Arena()
+		{
+			munmap(mem_, bytes_);
+		}
+
+		Arena() = delete;
+		Arena(const Arena&) = delete;
+		Arena(const Arena&&) = delete;
+		Arena& operator=(const Arena&) = delete;
+		Arena& operator=(const Arena&&) = delete;
+
+		void *data() const noexcept
+		{
+			return mem_;
+		}
+
+		size_t size() const noexcept
+		{
+			return bytes_;
+		}
+
+		/// The backing actually in use, EXPLICIT reports TRANSPARENT after a fallback.
+		HugePages huge_pages() const noexcept
+		{
+			return huge_pages_;
+		}
+	};
+
+	/// Types a container may leave as the zero bytes of fresh memory instead of constructing every slot up front, so
+	/// the storage is only committed as it is first written (C++20 implicit object creation makes a written slot an
+	/// object). A slot that was never written holds zero bytes, not T{}: for aggregates with non-zero default member
+	/// initializers (Side::BUY, ORDER_ID_INVALID, PRICE_INVALID) the two differ, so containers only hand out unwritten
+	/// slots for the caller to overwrite, never to read.
+	template<typename T>
+	constexpr bool is_lazily_committable = std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T> &&
+	                                       (std::is_aggregate_v<T> || std::is_trivially_default_constructible_v<T>);
+}
+
+#endif //LOWLATENCYFINTECH_MEM_UTILS_H
@@ -0,0 +1,208 @@
+#ifndef LOWLATENCYFINTECH_MPMC_Q_H
+#define LOWLATENCYFINTECH_MPMC_Q_H
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+
+#include "macros.h"
+#include "mem_utils.h"
+#include "thread_utils.h"
+#include "lock_free_q.h"
+
+/* Bounded multi producer multi consumer queue (per-slot sequence numbers, after Vyukov).
+ *
+ * Every slot carries a sequence number that says whose turn it is: seq == pos means the slot is free for the producer
+ * claiming position pos, seq == pos + 1 means it holds the element for the consumer claiming pos, and releasing it
+ * sets seq to pos + capacity, the producer position one lap later. Producers and consumers each race on their own
+ * claim counter with a CAS and never touch the other side's counter, the slot sequence numbers do the hand-off.
+ *
+ * The slot access API mirrors LFQueue, except that a claimed slot is handed back to the publishing call since several
+ * threads can hold claims at once:
+ *
+ *     T *slot = q.get_next_write_loc();   ...fill it...   q.update_write_idx(slot);
+ *     const T *slot = q.get_next_to_read();   ...use it...   q.update_read_idx(slot);
+ *
+ * A full queue spins (LFQOverflow::BLOCK) or returns nullptr (LFQOverflow::FAIL_FAST). DROP_NEWEST is not supported
+ * because a shared scratch slot would be written by several producers at once.
+ */
+template<typename T>
+class MPMCQueue final
+{
+private:
+	struct alignas(Common::CACHE_LINE_SIZE) Slot
+	{
+		T data_;
+		std::atomic<size_t> seq_;
+	};
+
+	const size_t capacity_;
+	const size_t mask_;
+	const LFQOverflow overflow_;
+
+	// Every slot's sequence number is written up front, so the whole Arena is committed in the constructor whatever
+	// the ArenaConfig, which still picks huge pages, the NUMA node and mlock.
+	Common::Arena arena_;
+	Slot *slots_ = nullptr;
+
+	alignas(Common::CACHE_LINE_SIZE) std::atomic<size_t> enqueue_pos_ = {0};
+	alignas(Common::CACHE_LINE_SIZE) std::atomic<size_t> dequeue_pos_ = {0};
+
+	char padding_[Common::CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+
+	static Slot *slot_of(const T *data) noexcept
+	{
+		return reinterpret_cast<Slot *>(const_cast<T *>(data));
+	}
+
+public:
+	explicit MPMCQueue(size_t num_elems, LFQOverflow overflow = LFQOverflow::BLOCK,
+	                   const Common::ArenaConfig &arena = {}) :
+		capacity_(std::bit_ceil(std::max<size_t>(num_elems, 2))), mask_(capacity_ - 1), overflow_(overflow),
+		arena_(capacity_ * sizeof(Slot), arena), slots_(static_cast<Slot *>(arena_.data()))
+	{
+		ASSERT(overflow_ != LFQOverflow::DROP_NEWEST, "MPMCQueue does not support DROP_NEWEST");
+
+		for (size_t i = 0; i < capacity_; i++)
+		{
+			new(&slots_[i]) Slot {T(), {i}};
+		}
+
+		ASSERT(reinterpret_cast<const Slot *>(&(slots_[0].data_)) == &(slots_[0]),
+		       "T object should be first member of Slot.");
+	}
+
+	~MPMCQueue()
+	{
+		for (size_t i = 0; i < capacity_; i++)
+		{
+			slots_[i].~Slot();
+		}
+	}
+
+	MPMCQueue() = delete;
+	MPMCQueue(const MPMCQueue&) = delete;
+	MPMCQueue(const MPMCQueue&&) = delete;
+	MPMCQueue& operator=(const MPMCQueue&) = delete;
+	MPMCQueue& operator=(const MPMCQueue&&) = delete;
+
+	/// Claims the next free slot for the calling producer.
+	T* get_next_write_loc() noexcept
+	{
+		size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+
+		while (true)
+		{
+			Slot &slot = slots_[pos & mask_];
+			const intptr_t diff = static_cast<intptr_t>(slot.seq_.load(std::memory_order_acquire)) -
+			                      static_cast<intptr_t>(pos);
+
+			if (diff == 0)
+			{
+				if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					return &slot.data_;
+				}
+			}
+			else if (diff < 0) [[unlikely]]
+			{
+				// A lap behind: full.
+				if (overflow_ == LFQOverflow::FAIL_FAST)
+				{
+					return nullptr;
+				}
+
+				cpu_relax();
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+			else
+			{
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	/// Hands the slot claimed by get_next_write_loc() to the consumers.
+	void update_write_idx(T *loc) noexcept
+	{
+		Slot *slot = slot_of(loc);
+		slot->seq_.store(slot->seq_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/// Claims the oldest published element for the calling consumer, nullptr when there is none.
+	const T* get_next_to_read() noexcept
+	{
+		size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+
+		while (true)
+		{
+			Slot &slot = slots_[pos & mask_];
+			const intptr_t diff = static_cast<intptr_t>(slot.seq_.load(std::memory_order_acquire)) -
+			                      static_cast<intptr_t>(pos + 1);
+
+			if (diff == 0)
+			{
+				if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					return &slot.data_;
+				}
+			}
+			else if (diff < 0)
+			{
+				return nullptr;
+			}
+			else
+			{
+				pos = dequeue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	/// Gives the slot claimed by get_next_to_read() back to the producers.
+	void update_read_idx(const T *loc) noexcept
+	{
+		Slot *slot = slot_of(loc);
+		slot->seq_.store(slot->seq_.load(std::memory_order_relaxed) - 1 + capacity_, std::memory_order_release);
+	}
+
+	bool try_push(const T &value) noexcept
+	{
+		T *slot = get_next_write_loc();
+		if (!slot)
+		{
+			return false;
+		}
+
+		*slot = value;
+		update_write_idx(slot);
+		return true;
+	}
+
+	bool try_pop(T &value) noexcept
+	{
+		const T *slot = get_next_to_read();
+		if (!slot)
+		{
+			return false;
+		}
+
+		value = *slot;
+		update_read_idx(slot);
+		return true;
+	}
+
+	/// Approximate while producers or consumers are running.
+	size_t size() const noexcept
+	{
+		const size_t dequeue_pos = dequeue_pos_.load(std::memory_order_acquire);
+		const size_t enqueue_pos = enqueue_pos_.load(std::memory_order_acquire);
+		return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+	}
+
+	size_t capacity() const noexcept
+	{
+		return capacity_;
+	}
+};
+
+#endif //LOWLATENCYFINTECH_MPMC_Q_H
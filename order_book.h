@@ -0,0 +1,392 @@
+#ifndef LOWLATENCYFINTECH_ORDER_BOOK_H
+#define LOWLATENCYFINTECH_ORDER_BOOK_H
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <limits>
+
+#include "macros.h"
+#include "mem_pool.h"
+#include "flat_tables.h"
+
+namespace Common
+{
+	typedef uint64_t OrderId;
+	typedef int64_t Price; // in ticks
+	typedef uint32_t Qty;
+
+	constexpr OrderId ORDER_ID_INVALID = std::numeric_limits<OrderId>::max();
+	constexpr Price PRICE_INVALID = std::numeric_limits<Price>::max();
+
+	// Ticks either side of a new level's price searched through the price index for a level to link it next to.
+	constexpr Price LEVEL_NEIGHBOUR_TICKS = 16;
+
+	enum class Side : int8_t
+	{
+		BUY = 1,
+		SELL = -1
+	};
+
+	inline const char *side_to_string(Side side) noexcept
+	{
+		return side == Side::BUY ? "BUY" : "SELL";
+	}
+
+	struct PriceLevel;
+
+	/// A resting order, linked into its level's FIFO queue.
+	struct BookOrder
+	{
+		OrderId id_ = ORDER_ID_INVALID;
+		Side side_ = Side::BUY;
+		Price price_ = PRICE_INVALID;
+		Qty qty_ = 0;
+
+		PriceLevel *level_ = nullptr;
+		BookOrder *prev_ = nullptr;
+		BookOrder *next_ = nullptr;
+	};
+
+	/// All orders at one price on one side, oldest first. Levels of a side are linked from best to worst.
+	struct PriceLevel
+	{
+		Side side_ = Side::BUY;
+		Price price_ = PRICE_INVALID;
+		uint64_t total_qty_ = 0;
+		uint32_t count_ = 0;
+
+		BookOrder *first_ = nullptr;
+		BookOrder *last_ = nullptr;
+
+		PriceLevel *better_ = nullptr;
+		PriceLevel *worse_ = nullptr;
+	};
+
+	struct BBO
+	{
+		Price bid_price_ = PRICE_INVALID;
+		uint64_t bid_qty_ = 0;
+		Price ask_price_ = PRICE_INVALID;
+		uint64_t ask_qty_ = 0;
+	};
+
+	/* Price-time priority limit order book for one instrument.
+	 *
+	 * Orders and levels come from MemPools sized up front, so the book never allocates after construction. Orders
+	 * are found by id through a DirectIndex (ids are dense, below max_order_id) and levels by price through a
+	 * FlatPriceMap per side sized from the level pool, so prices may be anywhere. Within a level orders form an
+	 * intrusive doubly linked FIFO, which makes add, cancel, execute and modify O(1). The levels of a side form a
+	 * doubly linked list from the best price down, so best bid and offer are a pointer read. A new level is linked in
+	 * next to the nearest level within LEVEL_NEIGHBOUR_TICKS, found with at most 2 * LEVEL_NEIGHBOUR_TICKS price index
+	 * lookups. Only a level further than that from every other one falls back to walking from the best price.
+	 */
+	class OrderBook final
+	{
+	private:
+		MemPool<BookOrder> order_pool_;
+		MemPool<PriceLevel> level_pool_;
+
+		DirectIndex<BookOrder *> orders_;
+		FlatPriceMap<PriceLevel *> bid_levels_;
+		FlatPriceMap<PriceLevel *> ask_levels_;
+
+		PriceLevel *best_bid_ = nullptr;
+		PriceLevel *best_ask_ = nullptr;
+
+		static bool is_better(Side side, Price price, Price than) noexcept
+		{
+			return side == Side::BUY ? price > than : price < than;
+		}
+
+		PriceLevel *&best(Side side) noexcept
+		{
+			return side == Side::BUY ? best_bid_ : best_ask_;
+		}
+
+		FlatPriceMap<PriceLevel *> &levels(Side side) noexcept
+		{
+			return side == Side::BUY ? bid_levels_ : ask_levels_;
+		}
+
+		PriceLevel *get_or_add_level(Side side, Price price) noexcept
+		{
+			if (PriceLevel *level = levels(side).find(price)) [[likely]]
+			{
+				return level;
+			}
+
+			PriceLevel *level = level_pool_.allocate();
+			level->side_ = side;
+			level->price_ = price;
+			levels(side).insert(price, level);
+
+			PriceLevel *better = nullptr;
+			PriceLevel *worse = best(side);
+			if (worse && !is_better(side, price, worse->price_))
+			{
+				// Closest level first, nothing lies between it and the new price so its list neighbour is ours too.
+				const Price toward_better = side == Side::BUY ? 1 : -1;
+				PriceLevel *neighbour = nullptr;
+				for (Price ticks = 1; ticks <= LEVEL_NEIGHBOUR_TICKS && !neighbour; ticks++)
+				{
+					if ((neighbour = levels(side).find(price + ticks * toward_better)))
+					{
+						better = neighbour;
+						worse = neighbour->worse_;
+					}
+					else if ((neighbour = levels(side).find(price - ticks * toward_better)))
+					{
+						better = neighbour->better_;
+						worse = neighbour;
+					}
+				}
+
+				// Isolated price: walk from the best price to the first level this one is better than.
+				while (!neighbour && worse && !is_better(side, price, worse->price_))
+				{
+					better = worse;
+					worse = worse->worse_;
+				}
+			}
+
+			level->better_ = better;
+			level->worse_ = worse;
+			if (worse)
+			{
+				worse->better_ = level;
+			}
+			if (better)
+			{
+				better->worse_ = level;
+			}
+			else
+			{
+				best(side) = level;
+			}
+
+			return level;
+		}
+
+		void remove_level(PriceLevel *level) noexcept
+		{
+			if (level->better_)
+			{
+				level->better_->worse_ = level->worse_;
+			}
+			else
+			{
+				best(level->side_) = level->worse_;
+			}
+			if (level->worse_)
+			{
+				level->worse_->better_ = level->better_;
+			}
+
+			levels(level->side_).erase(level->price_);
+			level_pool_.deallocate(level);
+		}
+
+		void link(PriceLevel *level, BookOrder *order) noexcept
+		{
+			order->level_ = level;
+			order->prev_ = level->last_;
+			order->next_ = nullptr;
+
+			if (level->last_)
+			{
+				level->last_->next_ = order;
+			}
+			else
+			{
+				level->first_ = order;
+			}
+			level->last_ = order;
+
+			level->total_qty_ += order->qty_;
+			level->count_++;
+		}
+
+		/// Takes the order out of its level, dropping the level once it is empty.
+		void unlink(BookOrder *order) noexcept
+		{
+			PriceLevel *level = order->level_;
+
+			if (order->prev_)
+			{
+				order->prev_->next_ = order->next_;
+			}
+			else
+			{
+				level->first_ = order->next_;
+			}
+			if (order->next_)
+			{
+				order->next_->prev_ = order->prev_;
+			}
+			else
+			{
+				level->last_ = order->prev_;
+			}
+
+			level->total_qty_ -= order->qty_;
+			if (--level->count_ == 0)
+			{
+				remove_level(level);
+			}
+		}
+
+		BookOrder *find(OrderId id) const noexcept
+		{
+			return orders_.find(id);
+		}
+
+	public:
+		OrderBook(size_t max_orders, size_t max_levels, size_t max_order_id) : order_pool_(max_orders),
+			level_pool_(max_levels), orders_(max_order_id, nullptr),
+			bid_levels_(max_levels), ask_levels_(max_levels)
+		{
+		}
+
+		OrderBook() = delete;
+		OrderBook(const OrderBook&) = delete;
+		OrderBook(const OrderBook&&) = delete;
+		OrderBook& operator=(const OrderBook&) = delete;
+		OrderBook& operator=(const OrderBook&&) = delete;
+
+		/// Rests a new order at the back of its price level. False if the id is out of range or already live, or the
+		/// book is out of orders or, for a new price, out of levels.
+		bool add(OrderId id, Side side, Price price, Qty qty) noexcept
+		{
+			if (id >= orders_.capacity() || orders_.find(id) || qty == 0 || order_pool_.free_count() == 0 ||
+			    !can_rest(side, price)) [[unlikely]]
+			{
+				return false;
+			}
+
+			BookOrder *order = order_pool_.allocate(BookOrder{id, side, price, qty});
+			link(get_or_add_level(side, price), order);
+			orders_[id] = order;
+			return true;
+		}
+
+		bool cancel(OrderId id) noexcept
+		{
+			BookOrder *order = find(id);
+			if (!order) [[unlikely]]
+			{
+				return false;
+			}
+
+			unlink(order);
+			orders_.erase(id);
+			order_pool_.deallocate(order);
+			return true;
+		}
+
+		/// Fills up to qty of a resting order, removing it once it is fully filled. Returns the quantity filled.
+		Qty execute(OrderId id, Qty qty) noexcept
+		{
+			BookOrder *order = find(id);
+			if (!order) [[unlikely]]
+			{
+				return 0;
+			}
+
+			if (qty >= order->qty_)
+			{
+				const Qty filled = order->qty_;
+				cancel(id);
+				return filled;
+			}
+
+			order->qty_ -= qty;
+			order->level_->total_qty_ -= qty;
+			return qty;
+		}
+
+		/// Reducing the quantity at the same price keeps the order's place in the queue, any other change sends it
+		/// to the back of its (new) level. False, with the order left as it was, if a new price finds no free level.
+		bool modify(OrderId id, Price price, Qty qty) noexcept
+		{
+			BookOrder *order = find(id);
+			if (!order || qty == 0) [[unlikely]]
+			{
+				return false;
+			}
+
+			if (price == order->price_ && qty <= order->qty_)
+			{
+				order->level_->total_qty_ -= order->qty_ - qty;
+				order->qty_ = qty;
+				return true;
+			}
+
+			if (!can_rest(order->side_, price)) [[unlikely]]
+			{
+				return false;
+			}
+
+			unlink(order);
+			order->price_ = price;
+			order->qty_ = qty;
+			link(get_or_add_level(order->side_, price), order);
+			return true;
+		}
+
+		const BookOrder *order(OrderId id) const noexcept
+		{
+			return find(id);
+		}
+
+		/// Whether an order at price can rest without the book running out of levels.
+		bool can_rest(Side side, Price price) const noexcept
+		{
+			const FlatPriceMap<PriceLevel *> &side_levels = side == Side::BUY ? bid_levels_ : ask_levels_;
+			return level_pool_.free_count() != 0 || side_levels.find(price);
+		}
+
+		const PriceLevel *best_bid() const noexcept
+		{
+			return best_bid_;
+		}
+
+		const PriceLevel *best_ask() const noexcept
+		{
+			return best_ask_;
+		}
+
+		const PriceLevel *best_level(Side side) const noexcept
+		{
+			return side == Side::BUY ? best_bid_ : best_ask_;
+		}
+
+		BBO bbo() const noexcept
+		{
+			BBO bbo;
+			if (best_bid_)
+			{
+				bbo.bid_price_ = best_bid_->price_;
+				bbo.bid_qty_ = best_bid_->total_qty_;
+			}
+			if (best_ask_)
+			{
+				bbo.ask_price_ = best_ask_->price_;
+				bbo.ask_qty_ = best_ask_->total_qty_;
+			}
+			return bbo;
+		}
+
+		size_t order_count() const noexcept
+		{
+			return order_pool_.capacity() - order_pool_.free_count();
+		}
+
+		size_t level_count() const noexcept
+		{
+			return level_pool_.capacity() - level_pool_.free_count();
+		}
+	};
+}
+
+#endif //LOWLATENCYFINTECH_ORDER_BOOK_H
@@ -0,0 +1,343 @@
+#ifndef LOWLATENCYFINTECH_ROLLING_WINDOW_H
+#define LOWLATENCYFINTECH_ROLLING_WINDOW_H
+
+#include <cstddef>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "RingBuffer.h"
+#include "time_utils.h"
+
+namespace Common
+{
+	/// Everything a RollingWindow keeps a running total of, recomputed in one pass. sum_ and sum_sq_ are of the
+	/// prices less a shift, which keeps the variance from cancelling away when prices are large next to their spread.
+	struct WindowSums
+	{
+		double sum_ = 0;
+		double sum_sq_ = 0;
+		double notional_ = 0;
+		double qty_ = 0;
+		double min_ = std::numeric_limits<double>::infinity();
+		double max_ = -std::numeric_limits<double>::infinity();
+	};
+
+	inline WindowSums window_sums_scalar(const double *prices, const double *qtys, size_t n, double shift) noexcept
+	{
+		WindowSums sums;
+		for (size_t i = 0; i < n; i++)
+		{
+			const double p = prices[i] - shift;
+			sums.sum_ += p;
+			sums.sum_sq_ += p * p;
+			sums.notional_ += prices[i] * qtys[i];
+			sums.qty_ += qtys[i];
+			sums.min_ = std::min(sums.min_, prices[i]);
+			sums.max_ = std::max(sums.max_, prices[i]);
+		}
+
+		return sums;
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	__attribute__((target("avx2,fma"))) inline double horizontal_add(__m256d v) noexcept
+	{
+		const __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+		return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+	}
+
+	/// Accumulators for one stream of four prices at a time.
+	struct WindowSumsAvx2
+	{
+		__m256d sum_;
+		__m256d sum_sq_;
+		__m256d notional_;
+		__m256d qty_;
+		__m256d min_;
+		__m256d max_;
+	};
+
+	__attribute__((target("avx2,fma"), always_inline)) inline void accumulate(WindowSumsAvx2 &acc, const double *prices,
+	                                                                        const double *qtys, __m256d shift) noexcept
+	{
+		const __m256d p = _mm256_loadu_pd(prices);
+		const __m256d q = _mm256_loadu_pd(qtys);
+		const __m256d shifted = _mm256_sub_pd(p, shift);
+
+		acc.sum_ = _mm256_add_pd(acc.sum_, shifted);
+		acc.sum_sq_ = _mm256_fmadd_pd(shifted, shifted, acc.sum_sq_);
+		acc.notional_ = _mm256_fmadd_pd(p, q, acc.notional_);
+		acc.qty_ = _mm256_add_pd(acc.qty_, q);
+		acc.min_ = _mm256_min_pd(acc.min_, p);
+		acc.max_ = _mm256_max_pd(acc.max_, p);
+	}
+
+	/// Four prices per instruction, compiled for AVX2 on its own so the rest of the build keeps the baseline ISA. Two
+	/// independent accumulators so each add does not wait on the one before it.
+	__attribute__((target("avx2,fma"))) inline WindowSums window_sums_avx2(const double *prices, const double *qtys,
+	                                                                       size_t n, double shift) noexcept
+	{
+		const __m256d shift4 = _mm256_set1_pd(shift);
+		const __m256d zero = _mm256_setzero_pd();
+		const __m256d inf = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+		const __m256d neg_inf = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+
+		WindowSumsAvx2 even = {zero, zero, zero, zero, inf, neg_inf};
+		WindowSumsAvx2 odd = even;
+
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			accumulate(even, prices + i, qtys + i, shift4);
+			accumulate(odd, prices + i + 4, qtys + i + 4, shift4);
+		}
+		for (; i + 4 <= n; i += 4)
+		{
+			accumulate(even, prices + i, qtys + i, shift4);
+		}
+
+		alignas(32) double lanes_min[4];
+		alignas(32) double lanes_max[4];
+		_mm256_store_pd(lanes_min, _mm256_min_pd(even.min_, odd.min_));
+		_mm256_store_pd(lanes_max, _mm256_max_pd(even.max_, odd.max_));
+
+		WindowSums sums = window_sums_scalar(prices + i, qtys + i, n - i, shift);
+		sums.sum_ += horizontal_add(_mm256_add_pd(even.sum_, odd.sum_));
+		sums.sum_sq_ += horizontal_add(_mm256_add_pd(even.sum_sq_, odd.sum_sq_));
+		sums.notional_ += horizontal_add(_mm256_add_pd(even.notional_, odd.notional_));
+		sums.qty_ += horizontal_add(_mm256_add_pd(even.qty_, odd.qty_));
+		sums.min_ = std::min({sums.min_, lanes_min[0], lanes_min[1], lanes_min[2], lanes_min[3]});
+		sums.max_ = std::max({sums.max_, lanes_max[0], lanes_max[1], lanes_max[2], lanes_max[3]});
+
+		return sums;
+	}
+#endif
+
+	using WindowSumsKernel = WindowSums (*)(const double *, const double *, size_t, double) noexcept;
+
+	/// Picks the widest kernel the CPU we are running on supports, once at startup.
+	inline WindowSumsKernel select_window_sums() noexcept
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		{
+			return window_sums_avx2;
+		}
+#endif
+		return window_sums_scalar;
+	}
+
+	inline const WindowSumsKernel window_sums = select_window_sums();
+
+	/* Rolling signals over the last max_ticks trades, optionally also bounded to the last max_age nanoseconds.
+	 *
+	 * Each trade updates sum, VWAP, variance and EWMA in O(1) from running totals, and min/max in amortised O(1) from
+	 * monotonic deques of window positions (a price only stays queued while no later price beats it). Prices,
+	 * quantities and timestamps are kept in separate contiguous RingBuffers, so recompute() can rebuild the totals
+	 * with the vectorised window_sums kernel. It does so every max_ticks trades to stop rounding drift from adding and
+	 * subtracting the same values forever.
+	 */
+	class RollingWindow final
+	{
+	private:
+		const nanos max_age_;
+		const double ewma_alpha_;
+
+		RingBuffer<nanos> times_;
+		RingBuffer<double> prices_;
+		RingBuffer<double> qtys_;
+
+		// Positions of the candidates for min and max, prices increasing and decreasing from front to back.
+		RingBuffer<size_t> min_positions_;
+		RingBuffer<size_t> max_positions_;
+
+		double shift_ = 0;
+		WindowSums sums_;
+		double ewma_ = 0;
+		size_t since_recompute_ = 0;
+
+		void pop_oldest() noexcept
+		{
+			const double price = prices_.front();
+			const double qty = qtys_.front();
+			const double shifted = price - shift_;
+
+			sums_.sum_ -= shifted;
+			sums_.sum_sq_ -= shifted * shifted;
+			sums_.notional_ -= price * qty;
+			sums_.qty_ -= qty;
+
+			const size_t pos = prices_.begin_pos();
+			if (min_positions_.front() == pos)
+			{
+				min_positions_.pop_front();
+			}
+			if (max_positions_.front() == pos)
+			{
+				max_positions_.pop_front();
+			}
+
+			times_.pop_front();
+			prices_.pop_front();
+			qtys_.pop_front();
+		}
+
+	public:
+		explicit RollingWindow(size_t max_ticks, nanos max_age = 0, double ewma_alpha = 0.1) : max_age_(max_age),
+			ewma_alpha_(ewma_alpha), times_(max_ticks), prices_(max_ticks), qtys_(max_ticks),
+			min_positions_(max_ticks), max_positions_(max_ticks)
+		{
+		}
+
+		RollingWindow() = delete;
+		RollingWindow(const RollingWindow&) = delete;
+		RollingWindow(const RollingWindow&&) = delete;
+		RollingWindow& operator=(const RollingWindow&) = delete;
+		RollingWindow& operator=(const RollingWindow&&) = delete;
+
+		void add(nanos ts, double price, double qty) noexcept
+		{
+			if (prices_.full())
+			{
+				pop_oldest();
+			}
+			expire(ts);
+
+			if (prices_.empty())
+			{
+				// Nothing left to drift from, start the totals over around this price.
+				shift_ = price;
+				sums_ = {};
+			}
+			if (prices_.end_pos() == 0)
+			{
+				ewma_ = price;
+			}
+
+			const size_t pos = prices_.end_pos();
+			times_.push_back(ts);
+			prices_.push_back(price);
+			qtys_.push_back(qty);
+
+			const double shifted = price - shift_;
+			sums_.sum_ += shifted;
+			sums_.sum_sq_ += shifted * shifted;
+			sums_.notional_ += price * qty;
+			sums_.qty_ += qty;
+
+			while (!min_positions_.empty() && prices_.at_pos(min_positions_.back()) >= price)
+			{
+				min_positions_.pop_back();
+			}
+			min_positions_.push_back(pos);
+
+			while (!max_positions_.empty() && prices_.at_pos(max_positions_.back()) <= price)
+			{
+				max_positions_.pop_back();
+			}
+			max_positions_.push_back(pos);
+
+			ewma_ += ewma_alpha_ * (price - ewma_);
+
+			if (++since_recompute_ == prices_.max_size())
+			{
+				recompute();
+			}
+		}
+
+		/// Drops trades older than max_age before now, also done on every add().
+		void expire(nanos now) noexcept
+		{
+			while (max_age_ != 0 && !prices_.empty() && now - times_.front() > max_age_)
+			{
+				pop_oldest();
+			}
+		}
+
+		/// Rebuilds the running totals from the window, re-centring the shift on the latest price.
+		void recompute() noexcept
+		{
+			since_recompute_ = 0;
+			if (prices_.empty())
+			{
+				sums_ = {};
+				return;
+			}
+
+			shift_ = prices_.back();
+			const WindowSums sums = window_sums(prices_.window().data(), qtys_.window().data(), prices_.size(),
+			                                    shift_);
+			sums_.sum_ = sums.sum_;
+			sums_.sum_sq_ = sums.sum_sq_;
+			sums_.notional_ = sums.notional_;
+			sums_.qty_ = sums.qty_;
+		}
+
+		/// The whole window reduced in one pass, min_ and max_ are of the raw prices.
+		WindowSums batch(WindowSumsKernel kernel = window_sums) const noexcept
+		{
+			return kernel(prices_.window().data(), qtys_.window().data(), prices_.size(), shift_);
+		}
+
+		size_t size() const noexcept
+		{
+			return prices_.size();
+		}
+
+		bool empty() const noexcept
+		{
+			return prices_.empty();
+		}
+
+		double sum() const noexcept
+		{
+			return sums_.sum_ + shift_ * static_cast<double>(prices_.size());
+		}
+
+		double mean() const noexcept
+		{
+			return shift_ + sums_.sum_ / static_cast<double>(prices_.size());
+		}
+
+		/// Population variance of the prices in the window.
+		double variance() const noexcept
+		{
+			const double n = static_cast<double>(prices_.size());
+			const double shifted_mean = sums_.sum_ / n;
+			return std::max(0.0, sums_.sum_sq_ / n - shifted_mean * shifted_mean);
+		}
+
+		double vwap() const noexcept
+		{
+			return sums_.notional_ / sums_.qty_;
+		}
+
+		double ewma() const noexcept
+		{
+			return ewma_;
+		}
+
+		double min() const noexcept
+		{
+			return prices_.at_pos(min_positions_.front());
+		}
+
+		double max() const noexcept
+		{
+			return prices_.at_pos(max_positions_.front());
+		}
+
+		std::span<const double> prices() const noexcept
+		{
+			return prices_.window();
+		}
+	};
+}
+
+#endif //LOWLATENCYFINTECH_ROLLING_WINDOW_H
@@ -43,7 +43,7 @@ namespace Common
 			return true;
 		}
 
-		return fcntl(fd, F_SETFL, (flags | O_NONBLOCK) != -1);
+		return fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
 	}
 
 	//Disabling Nogle's Algorithm which handles buffering improvements allows for better latency
@@ -54,10 +54,15 @@ namespace Common
 		return (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<void*>(&one), sizeof(one))!= -1);
 	}
 
+	//Has the kernel stamp every packet when it arrives, read back with rx_timestamp(). Nanoseconds where available.
 	bool set_so_timestamp(int fd)
 	{
 		int one = 1;
+#ifdef SO_TIMESTAMPNS
+		return (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, reinterpret_cast<void*>(&one), sizeof(one)) != -1);
+#else
 		return (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, reinterpret_cast<void*>(&one), sizeof(one)) != -1);
+#endif
 	}
 
 	bool would_block()
@@ -75,9 +80,136 @@ namespace Common
 		return (setsockopt(fd, IPPROTO_IP, IP_TTL, reinterpret_cast<void*>(&ttl), sizeof(ttl)) != -1);
 	}
 
+	//Sends multicast out of iface rather than wherever the default route points, "lo" keeps a feed on the host
+	bool set_m_cast_iface(int fd, const std::string &iface)
+	{
+		const std::string iface_ip = get_iface_ip(iface);
+		in_addr addr {};
+		addr.s_addr = iface_ip.empty() ? htonl(INADDR_ANY) : inet_addr(iface_ip.c_str());
+		return (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, reinterpret_cast<void*>(&addr), sizeof(addr)) != -1);
+	}
+
+	//A burst larger than the receive buffer is dropped by the kernel before we ever see it
+	bool set_rcv_buf(int fd, int bytes)
+	{
+		return (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<void*>(&bytes), sizeof(bytes)) != -1);
+	}
+
+	bool is_multicast(const std::string &ip)
+	{
+		in_addr addr {};
+		return inet_pton(AF_INET, ip.c_str(), &addr) == 1 && IN_MULTICAST(ntohl(addr.s_addr));
+	}
+
+	//Subscribes fd to the multicast group ip on the interface iface, any interface when iface has no IPv4 address.
+	//The port is picked by bind(), a membership is per group and interface only.
 	bool join(int fd, const std::string &ip, const std::string &iface, int port)
 	{
-		return false;
+		(void) port;
+
+		const std::string iface_ip = get_iface_ip(iface);
+		ip_mreq mreq {};
+		if (inet_pton(AF_INET, ip.c_str(), &mreq.imr_multiaddr) != 1)
+		{
+			return false;
+		}
+		mreq.imr_interface.s_addr = iface_ip.empty() ? htonl(INADDR_ANY) : inet_addr(iface_ip.c_str());
+
+		return (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, reinterpret_cast<void*>(&mreq), sizeof(mreq)) != -1);
+	}
+
+	//Fills up to count messages with one recvmmsg(), returns how many or -1 with errno set (EWOULDBLOCK when the
+	//socket is empty). Elsewhere one recvmsg() per message until the socket is drained.
+	int recv_mmsg(int fd, mmsghdr *msgs, unsigned int count)
+	{
+#ifndef __APPLE__
+		return recvmmsg(fd, msgs, count, MSG_DONTWAIT, nullptr);
+#else
+		unsigned int received = 0;
+		for (; received < count; received++)
+		{
+			const ssize_t n = recvmsg(fd, &msgs[received].msg_hdr, MSG_DONTWAIT);
+			if (n < 0)
+			{
+				break;
+			}
+			msgs[received].msg_len = static_cast<unsigned int>(n);
+		}
+		return received ? static_cast<int>(received) : -1;
+#endif
+	}
+
+	//Sends up to count messages on a connected socket with one sendmmsg(), returns how many went or -1 with errno set
+	int send_mmsg(int fd, mmsghdr *msgs, unsigned int count)
+	{
+#ifndef __APPLE__
+		return sendmmsg(fd, msgs, count, 0);
+#else
+		unsigned int sent = 0;
+		for (; sent < count; sent++)
+		{
+			const ssize_t n = sendmsg(fd, &msgs[sent].msg_hdr, 0);
+			if (n < 0)
+			{
+				break;
+			}
+			msgs[sent].msg_len = static_cast<unsigned int>(n);
+		}
+		return sent ? static_cast<int>(sent) : -1;
+#endif
+	}
+
+	//The kernel's receive time of a message read with recvmsg() or recvmmsg() from a socket with set_so_timestamp(),
+	//on the same clock as get_ns(). 0 when the control buffer holds no timestamp.
+	nanos rx_timestamp(msghdr &msg)
+	{
+		for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if (cmsg->cmsg_level != SOL_SOCKET)
+			{
+				continue;
+			}
+#ifdef SCM_TIMESTAMPNS
+			if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+			{
+				timespec ts;
+				memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				return ts.tv_sec * NANOS_TO_SECS + ts.tv_nsec;
+			}
+#endif
+			if (cmsg->cmsg_type == SCM_TIMESTAMP)
+			{
+				timeval tv;
+				memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+				return tv.tv_sec * NANOS_TO_SECS + tv.tv_usec * NANOS_TO_MICROS;
+			}
+		}
+
+		return 0;
+	}
+
+	//recv() that also returns the kernel's receive time of the data, or the time it was read when the socket has no
+	//timestamps turned on
+	ssize_t recv_timestamped(int fd, void *buf, size_t len, nanos &rx_ts)
+	{
+		iovec iov {buf, len};
+		RxTimestampControl control;
+		msghdr msg {};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf_;
+		msg.msg_controllen = sizeof(control.buf_);
+
+		const ssize_t n = recvmsg(fd, &msg, MSG_DONTWAIT);
+		if (n > 0)
+		{
+			rx_ts = rx_timestamp(msg);
+			if (rx_ts == 0)
+			{
+				rx_ts = get_ns();
+			}
+		}
+		return n;
 	}
 
 	int create_socket(Logger &logger, const std::string &t_ip, const std::string &iface, int port, bool is_udp,
@@ -114,6 +246,7 @@ namespace Common
 
 		int fd = 1;
 		int one = 1;
+		const bool multicast = is_udp && is_multicast(ip);
 
 		for (addrinfo *rp = res; rp; rp = rp->ai_next)
 		{
@@ -139,14 +272,21 @@ namespace Common
 				}
 			}
 
-			if (!is_listening && connect(fd, rp->ai_addr, rp->ai_addrlen) == 1 && !would_block())
+			//Before connect(), which picks the route a connected UDP socket sends on
+			if (multicast && !is_listening && !iface.empty() && !set_m_cast_iface(fd, iface))
+			{
+				logger.log("set_m_cast_iface() failed errno:%\n", strerror(errno));
+				return -1;
+			}
+
+			if (!is_listening && connect(fd, rp->ai_addr, rp->ai_addrlen) == -1 && !would_block())
 			{
 				logger.log("connect() failed errno:%\n", strerror(errno));
 				return -1;
 			}
 
 			if (is_listening &&
-			    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(one), sizeof(one)) == -1)
+			    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&one), sizeof(one)) == -1)
 			{
 				logger.log("setsockopt() SO_REUSEADDR failed errno:%\n", strerror(errno));
 				return -1;
@@ -164,9 +304,14 @@ namespace Common
 				return -1;
 			}
 
+			if (multicast && is_listening && !join(fd, ip, iface, port))
+			{
+				logger.log("join() failed errno:%\n", strerror(errno));
+				return -1;
+			}
+
 			if (is_udp && ttl)
 			{
-				const bool multicast = atoi(ip.c_str()) & 0xE0;
 				if (multicast && !set_m_cast_ttl(fd, ttl))
 				{
 					logger.log("set_m_cast_ttl() failed errno:%\n", strerror(errno));
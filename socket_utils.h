@@ -14,6 +14,8 @@
 #else
 #include <sys/epoll.h>
 #endif
+#include <cerrno>
+#include <cstring>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -25,12 +27,30 @@
 #include <fcntl.h>
 
 #include "macros.h"
+#include "time_utils.h"
 #include "Logger.h"
 
+#ifdef __APPLE__
+/// Linux's batch message header, recv_mmsg() and send_mmsg() fall back to one call per entry where recvmmsg() and
+/// sendmmsg() do not exist.
+struct mmsghdr
+{
+	msghdr msg_hdr;
+	unsigned int msg_len;
+};
+#endif
+
 namespace Common
 {
 	constexpr int MAX_TCP_SRV_BKLG = 1024;
 
+	/// Control buffer with room for the one message a kernel receive timestamp arrives in, aligned for cmsghdr.
+	union RxTimestampControl
+	{
+		cmsghdr align_;
+		char buf_[CMSG_SPACE(sizeof(timespec))];
+	};
+
 	std::string get_iface_ip(const std::string& iface);
 	bool set_nonblocking(int fd);
 	bool set_no_delay(int fd);
@@ -38,7 +58,14 @@ namespace Common
 	bool would_block();
 	bool set_m_cast_ttl(int fd, int ttl);
 	bool set_ttl(int fd, int ttl);
+	bool set_m_cast_iface(int fd, const std::string& iface);
+	bool set_rcv_buf(int fd, int bytes);
+	bool is_multicast(const std::string& ip);
 	bool join(int fd, const std::string& ip, const std::string& iface, int port);
+	int recv_mmsg(int fd, mmsghdr* msgs, unsigned int count);
+	int send_mmsg(int fd, mmsghdr* msgs, unsigned int count);
+	nanos rx_timestamp(msghdr& msg);
+	ssize_t recv_timestamped(int fd, void* buf, size_t len, nanos& rx_ts);
 	int create_socket(Logger& logger,  const std::string& t_ip, const std::string& iface, int port, bool is_udp, bool is_blocking, bool is_listening, int ttl, bool so_timestamp_needed);
 }
 
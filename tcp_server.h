@@ -0,0 +1,810 @@
+#ifndef LOWLATENCYFINTECH_TCP_SERVER_H
+#define LOWLATENCYFINTECH_TCP_SERVER_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <functional>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+
+#include "macros.h"
+#include "mem_utils.h"
+#include "time_utils.h"
+#include "thread_utils.h"
+#include "socket_utils.h"
+#include "io_uring.h"
+#include "Logger.h"
+
+#ifndef __APPLE__
+namespace Common
+{
+	/// Every frame on the wire is this header, the payload length in bytes in host byte order, then the payload.
+	typedef uint32_t TCPFrameHeader;
+
+	/// One connection and its buffers, which are carved out of the server's Arena when the server is built.
+	struct TCPSession
+	{
+		int fd_ = -1;
+		uint32_t index_ = 0;
+
+		uint8_t *rcv_ = nullptr;
+		size_t rcv_len_ = 0; // bytes received but not yet part of a complete frame
+
+		uint8_t *snd_ = nullptr;
+		size_t snd_begin_ = 0; // next byte for the kernel
+		size_t snd_end_ = 0; // end of the bytes queued
+		size_t snd_inflight_ = 0; // bytes of an io_uring send not completed yet, they stay where they are till then
+
+		// Set while in TCPServer's dirty list and only cleared by its flush, so a session closed and reused before
+		// then is still listed just once.
+		bool dirty_ = false;
+		uint32_t generation_ = 0; // bumped on close, io_uring completions for an earlier connection are ignored
+
+		bool is_open() const noexcept
+		{
+			return fd_ != -1;
+		}
+	};
+
+	struct TCPCallbacks
+	{
+		// Payload, length and receive time: the kernel's timestamp of the newest bytes in the read that completed the
+		// frame, or when that read returned if the server has kernel timestamps turned off. On io_uring it is when the
+		// poll() that reaped the receive completion started.
+		std::function<void(TCPSession &, const uint8_t *, size_t, nanos)> on_frame_;
+		std::function<void(TCPSession &)> on_connect_;
+		std::function<void(TCPSession &)> on_disconnect_;
+	};
+
+	struct TCPServerConfig
+	{
+		size_t max_sessions_ = 4096;
+		size_t rcv_buf_ = 16 * 1024; // per session, also bounds the largest frame
+		size_t snd_buf_ = 16 * 1024; // per session, what may be queued for a slow reader
+		int max_events_ = 1024; // per epoll_wait()
+		bool kernel_timestamps_ = true; // SO_TIMESTAMPNS on every session, epoll only
+		ArenaConfig arena_ = {}; // for the session buffers
+
+		IoBackend backend_ = IoBackend::EPOLL; // IO_URING falls back to EPOLL when the kernel refuses the ring
+		IoUringConfig uring_ = {.entries_ = 4096};
+		unsigned int uring_buffers_ = 4096; // provided receive buffers shared by all sessions, a power of two
+		size_t uring_buffer_size_ = 4096;
+	};
+
+	struct TCPServerStats
+	{
+		uint64_t accepted_ = 0;
+		uint64_t rejected_ = 0; // accepted and closed straight away, no session left
+		uint64_t closed_ = 0;
+		uint64_t frames_in_ = 0;
+		uint64_t frames_out_ = 0;
+		uint64_t send_overflows_ = 0; // frames refused by a full send buffer
+		uint64_t recv_calls_ = 0; // recv() calls, or receive completions on io_uring
+		uint64_t send_calls_ = 0;
+		uint64_t ring_enters_ = 0; // io_uring_enter() calls, the only syscalls of a running io_uring server
+		uint64_t buffer_shortages_ = 0; // io_uring receives stopped for want of a free provided buffer
+	};
+
+	/* Non-blocking TCP server on an edge-triggered epoll, for order entry sessions.
+	 *
+	 * All max_sessions_ sessions and their receive and send buffers are built in the constructor, the buffers in a
+	 * single Arena, and accept, read, frame and write only ever reuse them: nothing is allocated after startup. Each
+	 * socket gets TCP_NODELAY, since a frame is worth sending the moment it is complete, and SO_TIMESTAMPNS, so
+	 * reads go through recvmsg() and every frame carries the kernel's receive time.
+	 *
+	 * Being edge triggered, every readiness event is followed through until the kernel says EAGAIN: the listening
+	 * socket is accepted from until empty (a connection past max_sessions_ is closed right away, leaving it would
+	 * stall every later accept) and a readable session is read until drained. Bytes land behind whatever part of a
+	 * frame was already there, each complete frame is handed to on_frame_ straight from the receive buffer, and only
+	 * the trailing partial frame is moved back to the front.
+	 *
+	 * send_frame() appends to the session's send buffer and marks it dirty; poll() writes every dirty session once it
+	 * has handled its events, so all the replies a read produced leave in one send(). Whatever the kernel does not
+	 * take stays queued until EPOLLOUT says there is room again.
+	 *
+	 * connect() opens an outbound session handled exactly like an accepted one, for gateways and loopback tests.
+	 *
+	 * With backend_ IO_URING (Linux 6.0 or later) the same sessions are driven by completions instead of readiness.
+	 * Every socket sits in a fixed file slot, its session index, so requests skip the fd table. One multishot accept
+	 * stays armed on the listening socket, and one multishot receive on each session, which picks buffers from a
+	 * provided buffer ring shared by all sessions. A receive's frames are delivered straight from that buffer and only
+	 * a trailing partial frame is copied into the session. Sends go out as one IORING_OP_SEND per session at a time
+	 * from the send buffer. poll() reaps the completion ring and submits whatever it queued in one io_uring_enter(),
+	 * or with SQPOLL none at all while the kernel thread is awake.
+	 */
+	class TCPServer final
+	{
+	private:
+		const TCPServerConfig config_;
+		Logger &logger_;
+		const TCPCallbacks callbacks_;
+
+		enum class UringOp : uint8_t
+		{
+			ACCEPT = 0,
+			RECV = 1,
+			SEND = 2
+		};
+
+		IoBackend backend_ = IoBackend::EPOLL;
+		int epoll_fd_ = -1;
+		int listen_fd_ = -1;
+		std::unique_ptr<IoUring> ring_;
+		std::unique_ptr<IoUringBufRing> rx_buffers_;
+
+		Arena buffers_;
+		std::vector<TCPSession> sessions_;
+		std::vector<uint32_t> free_; // indices of closed sessions
+		std::vector<TCPSession *> dirty_;
+		std::vector<epoll_event> events_;
+
+		TCPServerStats stats_;
+
+		std::atomic<bool> running_ = false;
+		std::thread *thread_ = nullptr;
+
+		TCPSession *add_session(int fd) noexcept
+		{
+			if (free_.empty()) [[unlikely]]
+			{
+				close(fd);
+				stats_.rejected_++;
+				return nullptr;
+			}
+
+			TCPSession &session = sessions_[free_.back()];
+			if (!set_no_delay(fd)) [[unlikely]]
+			{
+				logger_.log("TCPServer set_no_delay() failed fd:% errno:%\n", fd, strerror(errno));
+			}
+			if (backend_ == IoBackend::IO_URING)
+			{
+				if (const int err = ring_->update_file(session.index_, fd); err < 0) [[unlikely]]
+				{
+					logger_.log("TCPServer io_uring file update failed fd:% errno:%\n", fd, strerror(-err));
+					close(fd);
+					return nullptr;
+				}
+			}
+			else
+			{
+				if (config_.kernel_timestamps_ && !set_so_timestamp(fd)) [[unlikely]]
+				{
+					logger_.log("TCPServer set_so_timestamp() failed fd:% errno:%\n", fd, strerror(errno));
+				}
+
+				epoll_event event {};
+				event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+				event.data.ptr = &session;
+				if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) == -1) [[unlikely]]
+				{
+					logger_.log("TCPServer epoll_ctl() failed fd:% errno:%\n", fd, strerror(errno));
+					close(fd);
+					return nullptr;
+				}
+			}
+
+			free_.pop_back();
+			session.fd_ = fd;
+			session.rcv_len_ = 0;
+			session.snd_begin_ = 0;
+			session.snd_end_ = 0;
+			session.snd_inflight_ = 0;
+			if (backend_ == IoBackend::IO_URING)
+			{
+				arm_recv(session);
+			}
+
+			if (callbacks_.on_connect_)
+			{
+				callbacks_.on_connect_(session);
+			}
+			return &session;
+		}
+
+		void accept_all() noexcept
+		{
+			for (;;)
+			{
+				const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK);
+				if (fd == -1)
+				{
+					if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) [[unlikely]]
+					{
+						logger_.log("TCPServer accept4() failed errno:%\n", strerror(errno));
+					}
+					if (errno != EINTR)
+					{
+						return;
+					}
+					continue;
+				}
+
+				stats_.accepted_++;
+				add_session(fd);
+			}
+		}
+
+		/// Hands every complete frame in data to on_frame_, returns the bytes they took. Closes the session on a frame
+		/// too large for the receive buffer.
+		size_t deliver_frames(TCPSession &session, const uint8_t *data, size_t len, nanos rx_ts) noexcept
+		{
+			size_t offset = 0;
+			while (len - offset >= sizeof(TCPFrameHeader))
+			{
+				TCPFrameHeader frame_len;
+				std::memcpy(&frame_len, data + offset, sizeof(frame_len));
+				if (frame_len > config_.rcv_buf_ - sizeof(TCPFrameHeader)) [[unlikely]]
+				{
+					logger_.log("TCPServer session % sent a % byte frame, closing\n", session.index_, frame_len);
+					close_session(session);
+					return offset;
+				}
+				if (len - offset < sizeof(TCPFrameHeader) + frame_len)
+				{
+					break;
+				}
+
+				stats_.frames_in_++;
+				callbacks_.on_frame_(session, data + offset + sizeof(TCPFrameHeader), frame_len, rx_ts);
+				if (!session.is_open())
+				{
+					return offset;
+				}
+				offset += sizeof(TCPFrameHeader) + frame_len;
+			}
+			return offset;
+		}
+
+		/// Hands every complete frame in the receive buffer to on_frame_, keeps the partial one at the front.
+		void deliver(TCPSession &session, nanos rx_ts) noexcept
+		{
+			const size_t offset = deliver_frames(session, session.rcv_, session.rcv_len_, rx_ts);
+			if (offset != 0 && session.is_open())
+			{
+				std::memmove(session.rcv_, session.rcv_ + offset, session.rcv_len_ - offset);
+				session.rcv_len_ -= offset;
+			}
+		}
+
+		void read(TCPSession &session) noexcept
+		{
+			while (session.is_open())
+			{
+				nanos rx_ts = 0;
+				const ssize_t n = recv_timestamped(session.fd_, session.rcv_ + session.rcv_len_,
+				                                   config_.rcv_buf_ - session.rcv_len_, rx_ts);
+				if (n > 0)
+				{
+					stats_.recv_calls_++;
+					const bool drained = static_cast<size_t>(n) < config_.rcv_buf_ - session.rcv_len_;
+					session.rcv_len_ += static_cast<size_t>(n);
+					deliver(session, rx_ts);
+
+					// A short read emptied the socket, anything arriving later raises a new edge, so the recv() that
+					// would only say EAGAIN can be skipped.
+					if (drained)
+					{
+						return;
+					}
+				}
+				else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+				{
+					close_session(session);
+				}
+				else if (errno != EINTR)
+				{
+					return;
+				}
+			}
+		}
+
+		void write(TCPSession &session) noexcept
+		{
+			while (session.snd_begin_ != session.snd_end_)
+			{
+				const ssize_t n = send(session.fd_, session.snd_ + session.snd_begin_,
+				                       session.snd_end_ - session.snd_begin_, MSG_NOSIGNAL);
+				if (n > 0)
+				{
+					stats_.send_calls_++;
+					session.snd_begin_ += static_cast<size_t>(n);
+				}
+				else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOTCONN)
+				{
+					// EPOLLOUT comes once there is room, or once an outbound connect() completes.
+					return;
+				}
+				else if (errno != EINTR)
+				{
+					close_session(session);
+					return;
+				}
+			}
+
+			session.snd_begin_ = 0;
+			session.snd_end_ = 0;
+		}
+
+		void flush_dirty() noexcept
+		{
+			for (TCPSession *session : dirty_)
+			{
+				session->dirty_ = false;
+				if (session->is_open())
+				{
+					if (backend_ == IoBackend::IO_URING)
+					{
+						send_uring(*session);
+					}
+					else
+					{
+						write(*session);
+					}
+				}
+			}
+			dirty_.clear();
+		}
+
+		void setup_uring() noexcept
+		{
+			auto ring = std::make_unique<IoUring>(config_.uring_);
+			if (!ring->valid())
+			{
+				logger_.log("TCPServer io_uring setup failed errno:%, using epoll\n", strerror(ring->error()));
+				return;
+			}
+
+			// One slot per session, the listening socket in the last one.
+			std::vector<int> slots(config_.max_sessions_ + 1, -1);
+			if (const int err = ring->register_files(slots.data(), static_cast<unsigned>(slots.size())); err < 0)
+			{
+				logger_.log("TCPServer io_uring file registration failed errno:%, using epoll\n", strerror(-err));
+				return;
+			}
+
+			auto buffers = std::make_unique<IoUringBufRing>(*ring, 0, config_.uring_buffers_,
+			                                                config_.uring_buffer_size_, config_.arena_);
+			if (!buffers->valid())
+			{
+				logger_.log("TCPServer io_uring has no provided buffer rings, using epoll\n");
+				return;
+			}
+
+			ring_ = std::move(ring);
+			rx_buffers_ = std::move(buffers);
+			backend_ = IoBackend::IO_URING;
+		}
+
+		static uint64_t uring_tag(UringOp op, uint32_t index, uint32_t generation) noexcept
+		{
+			return static_cast<uint64_t>(generation) << 32 | static_cast<uint64_t>(index) << 8 |
+			       static_cast<uint64_t>(op);
+		}
+
+		io_uring_sqe *next_sqe() noexcept
+		{
+			io_uring_sqe *sqe = ring_->get_sqe();
+			while (!sqe) [[unlikely]]
+			{
+				ring_->submit();
+				sqe = ring_->get_sqe();
+			}
+			return sqe;
+		}
+
+		void arm_accept() noexcept
+		{
+			io_uring_sqe *sqe = next_sqe();
+			sqe->opcode = IORING_OP_ACCEPT;
+			sqe->fd = static_cast<int>(config_.max_sessions_);
+			sqe->flags = IOSQE_FIXED_FILE;
+			sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+			sqe->accept_flags = SOCK_NONBLOCK;
+			sqe->user_data = uring_tag(UringOp::ACCEPT, 0, 0);
+		}
+
+		void arm_recv(const TCPSession &session) noexcept
+		{
+			io_uring_sqe *sqe = next_sqe();
+			sqe->opcode = IORING_OP_RECV;
+			sqe->fd = static_cast<int>(session.index_);
+			sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+			sqe->ioprio = IORING_RECV_MULTISHOT;
+			sqe->buf_group = rx_buffers_->group();
+			sqe->user_data = uring_tag(UringOp::RECV, session.index_, session.generation_);
+		}
+
+		/// Sends everything queued unless a send is still in flight, its completion sends the rest.
+		void send_uring(TCPSession &session) noexcept
+		{
+			if (session.snd_inflight_ != 0 || session.snd_begin_ == session.snd_end_)
+			{
+				return;
+			}
+
+			io_uring_sqe *sqe = next_sqe();
+			sqe->opcode = IORING_OP_SEND;
+			sqe->fd = static_cast<int>(session.index_);
+			sqe->flags = IOSQE_FIXED_FILE;
+			sqe->addr = reinterpret_cast<uint64_t>(session.snd_ + session.snd_begin_);
+			sqe->len = static_cast<uint32_t>(session.snd_end_ - session.snd_begin_);
+			sqe->msg_flags = MSG_NOSIGNAL;
+			sqe->user_data = uring_tag(UringOp::SEND, session.index_, session.generation_);
+			session.snd_inflight_ = sqe->len;
+		}
+
+		/// Frames straight out of a provided buffer while nothing is pending, otherwise behind the pending bytes.
+		void receive(TCPSession &session, const uint8_t *data, size_t len, nanos rx_ts) noexcept
+		{
+			while (len != 0 && session.is_open())
+			{
+				if (session.rcv_len_ == 0)
+				{
+					const size_t used = deliver_frames(session, data, len, rx_ts);
+					if (session.is_open())
+					{
+						// What is left is a partial frame that deliver_frames() found fits the receive buffer.
+						std::memcpy(session.rcv_, data + used, len - used);
+						session.rcv_len_ = len - used;
+					}
+					return;
+				}
+
+				const size_t n = std::min(len, config_.rcv_buf_ - session.rcv_len_);
+				std::memcpy(session.rcv_ + session.rcv_len_, data, n);
+				session.rcv_len_ += n;
+				data += n;
+				len -= n;
+				deliver(session, rx_ts);
+			}
+		}
+
+		void complete(const io_uring_cqe &cqe, nanos rx_ts) noexcept
+		{
+			const auto op = static_cast<UringOp>(cqe.user_data & 0xFF);
+			const bool more = cqe.flags & IORING_CQE_F_MORE;
+
+			if (op == UringOp::ACCEPT)
+			{
+				if (cqe.res >= 0)
+				{
+					stats_.accepted_++;
+					add_session(cqe.res);
+				}
+				else if (cqe.res != -EAGAIN && cqe.res != -EINTR) [[unlikely]]
+				{
+					logger_.log("TCPServer io_uring accept failed errno:%\n", strerror(-cqe.res));
+				}
+				if (!more && listen_fd_ != -1)
+				{
+					arm_accept();
+				}
+				return;
+			}
+
+			TCPSession &session = sessions_[(cqe.user_data >> 8) & 0xFFFFFF];
+			const bool current = session.is_open() && session.generation_ == static_cast<uint32_t>(cqe.user_data >> 32);
+
+			if (op == UringOp::RECV)
+			{
+				if (cqe.flags & IORING_CQE_F_BUFFER)
+				{
+					const uint16_t id = IoUringBufRing::buffer_id(cqe);
+					if (current && cqe.res > 0)
+					{
+						stats_.recv_calls_++;
+						receive(session, rx_buffers_->buffer(id), static_cast<size_t>(cqe.res), rx_ts);
+					}
+					rx_buffers_->recycle(id);
+				}
+
+				if (!current || !session.is_open())
+				{
+					return;
+				}
+				if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS))
+				{
+					close_session(session);
+				}
+				else if (!more)
+				{
+					stats_.buffer_shortages_ += cqe.res == -ENOBUFS;
+					arm_recv(session);
+				}
+				return;
+			}
+
+			if (!current)
+			{
+				return;
+			}
+			session.snd_inflight_ = 0;
+			if (cqe.res < 0)
+			{
+				close_session(session);
+				return;
+			}
+
+			stats_.send_calls_++;
+			session.snd_begin_ += static_cast<size_t>(cqe.res);
+			if (session.snd_begin_ == session.snd_end_)
+			{
+				session.snd_begin_ = 0;
+				session.snd_end_ = 0;
+			}
+			else
+			{
+				send_uring(session);
+			}
+		}
+
+		size_t poll_uring() noexcept
+		{
+			const nanos rx_ts = get_ns();
+			auto reap = [this, rx_ts]()
+			{
+				return ring_->for_each_cqe([this, rx_ts](const io_uring_cqe &cqe)
+				{
+					complete(cqe, rx_ts);
+				});
+			};
+
+			unsigned completions = reap();
+			flush_dirty();
+			ring_->submit();
+			// Sends the socket had room for completed inside that submit, reaping them now frees their part of the
+			// send buffer before the next receive queues more replies behind it.
+			completions += reap();
+
+			stats_.ring_enters_ = ring_->enters();
+			return completions;
+		}
+
+		void run() noexcept
+		{
+			logger_.log("TCPServer started, max sessions: % backend: %\n", config_.max_sessions_,
+			            backend_ == IoBackend::IO_URING ? (ring_->sqpoll() ? "io_uring sqpoll" : "io_uring") : "epoll");
+
+			while (running_.load(std::memory_order_acquire))
+			{
+				if (poll() == 0)
+				{
+					cpu_relax();
+				}
+			}
+
+			logger_.log("TCPServer stopped, accepted: % frames in: % out: %\n", stats_.accepted_, stats_.frames_in_,
+			            stats_.frames_out_);
+		}
+
+	public:
+		TCPServer(Logger &logger, const TCPCallbacks &callbacks, const TCPServerConfig &config = {}) : config_(config),
+			logger_(logger), callbacks_(callbacks),
+			buffers_(config.max_sessions_ * (config.rcv_buf_ + config.snd_buf_), config.arena_),
+			sessions_(config.max_sessions_), events_(config.max_events_)
+		{
+			ASSERT(callbacks_.on_frame_ != nullptr, "TCPServer needs an on_frame_ callback");
+			ASSERT(config_.rcv_buf_ > sizeof(TCPFrameHeader), "TCPServer receive buffer can not hold a frame");
+
+			if (config_.backend_ == IoBackend::IO_URING)
+			{
+				setup_uring();
+			}
+			if (backend_ == IoBackend::EPOLL)
+			{
+				epoll_fd_ = epoll_create1(0);
+				ASSERT(epoll_fd_ != -1, "epoll_create1() failed");
+			}
+
+			uint8_t *buffers = static_cast<uint8_t *>(buffers_.data());
+			free_.reserve(config_.max_sessions_);
+			dirty_.reserve(config_.max_sessions_);
+			for (size_t i = config_.max_sessions_; i > 0; i--)
+			{
+				TCPSession &session = sessions_[i - 1];
+				session.index_ = static_cast<uint32_t>(i - 1);
+				session.rcv_ = buffers + (i - 1) * (config_.rcv_buf_ + config_.snd_buf_);
+				session.snd_ = session.rcv_ + config_.rcv_buf_;
+				free_.push_back(session.index_);
+			}
+		}
+
+		~TCPServer()
+		{
+			stop();
+			for (TCPSession &session : sessions_)
+			{
+				if (session.is_open())
+				{
+					close_session(session);
+				}
+			}
+			if (listen_fd_ != -1)
+			{
+				close(listen_fd_);
+			}
+			if (epoll_fd_ != -1)
+			{
+				close(epoll_fd_);
+			}
+		}
+
+		TCPServer() = delete;
+		TCPServer(const TCPServer&) = delete;
+		TCPServer(const TCPServer&&) = delete;
+		TCPServer& operator=(const TCPServer&) = delete;
+		TCPServer& operator=(const TCPServer&&) = delete;
+
+		/// Listens on port at iface's address ("lo" for loopback only).
+		bool listen(const std::string &iface, int port) noexcept
+		{
+			listen_fd_ = create_socket(logger_, "", iface, port, false, false, true, 0, false);
+			if (listen_fd_ == -1)
+			{
+				return false;
+			}
+
+			if (backend_ == IoBackend::IO_URING)
+			{
+				const int err = ring_->update_file(static_cast<unsigned>(config_.max_sessions_), listen_fd_);
+				if (err < 0)
+				{
+					logger_.log("TCPServer io_uring file update failed fd:% errno:%\n", listen_fd_, strerror(-err));
+					return false;
+				}
+				arm_accept();
+				ring_->submit();
+				return true;
+			}
+
+			epoll_event event {};
+			event.events = EPOLLIN | EPOLLET;
+			event.data.ptr = nullptr;
+			return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event) != -1;
+		}
+
+		/// Starts a non-blocking connect to ip:port, frames can be queued before it completes.
+		TCPSession *connect(const std::string &ip, int port) noexcept
+		{
+			const int fd = create_socket(logger_, ip, "", port, false, false, false, 0, false);
+			return fd == -1 ? nullptr : add_session(fd);
+		}
+
+		/// Queues one frame for the session, sent by the next poll(). False, and nothing queued, if it does not fit.
+		bool send_frame(TCPSession &session, const void *payload, size_t len) noexcept
+		{
+			const size_t need = sizeof(TCPFrameHeader) + len;
+			if (config_.snd_buf_ - session.snd_end_ < need && session.snd_begin_ != 0 && session.snd_inflight_ == 0)
+			{
+				std::memmove(session.snd_, session.snd_ + session.snd_begin_, session.snd_end_ - session.snd_begin_);
+				session.snd_end_ -= session.snd_begin_;
+				session.snd_begin_ = 0;
+			}
+			if (!session.is_open() || config_.snd_buf_ - session.snd_end_ < need) [[unlikely]]
+			{
+				stats_.send_overflows_++;
+				return false;
+			}
+
+			const TCPFrameHeader header = static_cast<TCPFrameHeader>(len);
+			std::memcpy(session.snd_ + session.snd_end_, &header, sizeof(header));
+			std::memcpy(session.snd_ + session.snd_end_ + sizeof(header), payload, len);
+			session.snd_end_ += need;
+			stats_.frames_out_++;
+
+			if (!session.dirty_)
+			{
+				session.dirty_ = true;
+				dirty_.push_back(&session);
+			}
+			return true;
+		}
+
+		void close_session(TCPSession &session) noexcept
+		{
+			if (!session.is_open())
+			{
+				return;
+			}
+
+			if (callbacks_.on_disconnect_)
+			{
+				callbacks_.on_disconnect_(session);
+			}
+			if (backend_ == IoBackend::IO_URING)
+			{
+				// Ends the multishot receive and any send in flight, their completions then carry an old generation.
+				shutdown(session.fd_, SHUT_RDWR);
+				ring_->update_file(session.index_, -1);
+				session.generation_++;
+			}
+			close(session.fd_); // also takes it out of the epoll set
+			session.fd_ = -1;
+			free_.push_back(session.index_);
+			stats_.closed_++;
+		}
+
+		/// Handles whatever is ready without waiting, then flushes every session with frames queued. Returns the
+		/// number of epoll events, or io_uring completions.
+		size_t poll() noexcept
+		{
+			if (backend_ == IoBackend::IO_URING)
+			{
+				return poll_uring();
+			}
+
+			const int ready = epoll_wait(epoll_fd_, events_.data(), config_.max_events_, 0);
+
+			for (int i = 0; i < ready; i++)
+			{
+				const epoll_event &event = events_[i];
+				if (!event.data.ptr)
+				{
+					accept_all();
+					continue;
+				}
+
+				TCPSession &session = *static_cast<TCPSession *>(event.data.ptr);
+				if (event.events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+				{
+					read(session);
+				}
+				if (session.is_open() && (event.events & EPOLLOUT))
+				{
+					write(session);
+				}
+			}
+
+			flush_dirty();
+
+			return ready > 0 ? static_cast<size_t>(ready) : 0;
+		}
+
+		/// Runs the poll loop on its own thread pinned to core_id (-1 leaves it unpinned).
+		void start(int core_id)
+		{
+			running_ = true;
+			thread_ = launch_thread(core_id, "Exchange/TCPServer", [this]()
+			{
+				run();
+			});
+			ASSERT(thread_ != nullptr, "Failed to start TCP server thread");
+		}
+
+		void stop()
+		{
+			if (!thread_)
+			{
+				return;
+			}
+
+			running_ = false;
+			thread_->join();
+			delete thread_;
+			thread_ = nullptr;
+		}
+
+		/// The backend actually in use, EPOLL if IO_URING was asked for and the kernel refused it.
+		IoBackend backend() const noexcept
+		{
+			return backend_;
+		}
+
+		size_t session_count() const noexcept
+		{
+			return config_.max_sessions_ - free_.size();
+		}
+
+		const TCPServerStats &stats() const noexcept
+		{
+			return stats_;
+		}
+	};
+}
+#endif
+
+#endif //LOWLATENCYFINTECH_TCP_SERVER_H
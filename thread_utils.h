@@ -12,6 +12,10 @@
 #include <pthread.h>
 
 #include <sys/syscall.h>
+#ifndef __APPLE__
+#include <linux/futex.h>
+#include <ctime>
+#endif
 
 inline bool setThreadCore(int core_id) noexcept
 {
@@ -40,9 +44,11 @@ void wrapper(Function&& func, Args&&... args)
 
 /// Creates a thread instance, sets affinity on it, assigns it a name and
 /// passes the function to be run on that thread as well as the arguments to the function.
+/// The function and arguments are moved into the thread (std::thread semantics, use std::ref to share), so
+/// there is nothing on the caller's stack the thread still needs and no reason to wait for it to start.
 template<typename T, typename... A>
 inline std::thread* launch_thread(int core_id, const std::string &name, T &&func, A &&... args) noexcept {
-	std::thread* t = new std::thread([&]()
+	std::thread* t = new std::thread([core_id, name, func = std::forward<T>(func), ...args = std::forward<A>(args)]() mutable
 			{
 #ifndef __APPLE__
 		if (core_id >= 0 && !setThreadCore(core_id))
@@ -52,13 +58,45 @@ inline std::thread* launch_thread(int core_id, const std::string &name, T &&func
 		}
 		std::cerr << "Set core affinity for " << name << " " << pthread_self() << " to " << core_id << std::endl;
 #endif
-		std::forward<T>(func)((std::forward<A>(args))...); //Perfect Forwarding
+		func(std::move(args)...);
 	});
 
-	using namespace std::literals::chrono_literals;
-	std::this_thread::sleep_for(1s);
-
 	return t;
 }
 
+/// Spin-wait hint: lets the sibling hyper-thread run and keeps the spin loop from flooding the memory pipeline.
+inline void cpu_relax() noexcept
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield" ::: "memory");
+#endif
+}
+
+/// Parks the calling thread while word still holds expected, for at most timeout_ns. Spurious and early wakeups
+/// are allowed, callers re-check their condition. Falls back to a plain sleep where futexes are not available.
+inline void park_thread(std::atomic<uint32_t> &word, uint32_t expected, int64_t timeout_ns) noexcept
+{
+#ifndef __APPLE__
+	timespec timeout {static_cast<time_t>(timeout_ns / 1000000000), static_cast<long>(timeout_ns % 1000000000)};
+	syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT_PRIVATE, expected, &timeout, nullptr, 0);
+#else
+	if (word.load(std::memory_order_acquire) == expected)
+	{
+		std::this_thread::sleep_for(std::chrono::nanoseconds(timeout_ns));
+	}
+#endif
+}
+
+/// Wakes every thread parked on word by park_thread(). The caller changes word first.
+inline void unpark_threads(std::atomic<uint32_t> &word) noexcept
+{
+#ifndef __APPLE__
+	syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#else
+	(void) word;
+#endif
+}
+
 #endif //LOWLATENCYFINTECH_THREAD_UTILS_H